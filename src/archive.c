@@ -0,0 +1,634 @@
+
+/*
+ *  This file is part of Complexity.
+ *  Complexity Copyright (c) 2011-2020 by Bruce Korb - all rights reserved
+ *
+ *  Complexity is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Complexity is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Read C sources directly out of tar archives.  The archive may be
+ * compressed with any of the compression libraries found by configure.
+ * Members are decompressed into memory and handed to the scorer;
+ * nothing is ever extracted to disk.
+ */
+
+#include "opts.h"
+#include <stdlib.h>
+
+#if defined(HAVE_LIBZ) && defined(HAVE_ZLIB_H)
+# define ARC_HAVE_GZIP 1
+# include <zlib.h>
+#endif
+
+#if defined(HAVE_LIBLZMA) && defined(HAVE_LZMA_H)
+# define ARC_HAVE_XZ 1
+# include <lzma.h>
+#endif
+
+#if defined(HAVE_LIBBZ2) && defined(HAVE_BZLIB_H)
+# define ARC_HAVE_BZIP2 1
+# include <bzlib.h>
+#endif
+
+#define ARC_INBUF_SIZE  (64 * 1024)
+#define TAR_BLOCK       512
+
+#define TAR_NAME_OFF    0
+#define TAR_NAME_LEN    100
+#define TAR_SIZE_OFF    124
+#define TAR_SIZE_LEN    12
+#define TAR_CKSUM_OFF   148
+#define TAR_CKSUM_LEN   8
+#define TAR_TYPE_OFF    156
+#define TAR_PREFIX_OFF  345
+#define TAR_PREFIX_LEN  155
+
+/*
+ * Members that are read into memory, and long names, may be no larger
+ * than this.  Anything bigger is taken as a corrupt header.
+ */
+#define TAR_MAX_TEXT    ((size_t)1 << 30)
+#define TAR_MAX_LNAME   ((size_t)1 << 20)
+
+#define ARC_KIND_TABLE                          \
+    _Atbl_(ARC_PLAIN, "uncompressed")           \
+    _Atbl_(ARC_GZIP,  "gzip")                   \
+    _Atbl_(ARC_XZ,    "xz")                     \
+    _Atbl_(ARC_BZIP2, "bzip2")
+
+#define _Atbl_(_e, _s) _e,
+typedef enum { ARC_KIND_TABLE } arc_kind_t;
+#undef  _Atbl_
+
+typedef struct {
+    FILE *          ar_fp;
+    char const *    ar_fname;
+    arc_kind_t      ar_kind;
+    bool            ar_eof;     //!< no more decompressed data
+    bool            ar_err;     //!< read or decompression failure
+    unsigned char * ar_in_next; //!< unconsumed input (plain archives)
+    size_t          ar_in_len;
+    union {
+#ifdef ARC_HAVE_GZIP
+        z_stream    zs;
+#endif
+#ifdef ARC_HAVE_XZ
+        lzma_stream xs;
+#endif
+#ifdef ARC_HAVE_BZIP2
+        bz_stream   bs;
+#endif
+        int         none;
+    } ar_u;
+    unsigned char   ar_in[ARC_INBUF_SIZE];
+} arc_rdr_t;
+
+static char const arc_err_fmt[] = "archive %s: %s\n";
+static char const nomem_fmt[]   = "could not allocate %d bytes\n";
+
+static void
+arc_error(arc_rdr_t * ar, char const * msg)
+{
+    if (! ar->ar_err)
+        fprintf(stderr, arc_err_fmt, ar->ar_fname, msg);
+    ar->ar_err = ar->ar_eof = true;
+}
+
+/**
+ * refill the raw input buffer.  Returns the number of bytes now available.
+ */
+static size_t
+arc_fill(arc_rdr_t * ar)
+{
+    size_t ct = fread(ar->ar_in, 1, sizeof(ar->ar_in), ar->ar_fp);
+    if ((ct == 0) && ferror(ar->ar_fp))
+        arc_error(ar, strerror(errno));
+    ar->ar_in_next = ar->ar_in;
+    ar->ar_in_len  = ct;
+    return ct;
+}
+
+static size_t
+plain_read(arc_rdr_t * ar, unsigned char * buf, size_t len)
+{
+    size_t res = 0;
+
+    while ((res < len) && ! ar->ar_eof) {
+        if ((ar->ar_in_len == 0) && (arc_fill(ar) == 0)) {
+            ar->ar_eof = true;
+            break;
+        }
+
+        size_t ct = len - res;
+        if (ct > ar->ar_in_len)
+            ct = ar->ar_in_len;
+        memcpy(buf + res, ar->ar_in_next, ct);
+        ar->ar_in_next += ct;
+        ar->ar_in_len  -= ct;
+        res += ct;
+    }
+
+    return res;
+}
+
+#ifdef ARC_HAVE_GZIP
+static size_t
+gzip_read(arc_rdr_t * ar, unsigned char * buf, size_t len)
+{
+    z_stream * zs = &ar->ar_u.zs;
+
+    zs->next_out  = buf;
+    zs->avail_out = len;
+
+    while ((zs->avail_out > 0) && ! ar->ar_eof) {
+        if (zs->avail_in == 0) {
+            if (arc_fill(ar) == 0) {
+                ar->ar_eof = true;
+                break;
+            }
+            zs->next_in  = ar->ar_in;
+            zs->avail_in = ar->ar_in_len;
+        }
+
+        switch (inflate(zs, Z_NO_FLUSH)) {
+        case Z_STREAM_END:
+            /*
+             * gzip files may be concatenated.  Start over on the next one.
+             */
+            inflateReset(zs);
+            break;
+
+        case Z_OK:
+        case Z_BUF_ERROR:
+            break;
+
+        default:
+            arc_error(ar, zs->msg ? zs->msg : "gzip data error");
+        }
+    }
+
+    return len - zs->avail_out;
+}
+#endif /* ARC_HAVE_GZIP */
+
+#ifdef ARC_HAVE_XZ
+static size_t
+xz_read(arc_rdr_t * ar, unsigned char * buf, size_t len)
+{
+    lzma_stream * xs = &ar->ar_u.xs;
+
+    xs->next_out  = buf;
+    xs->avail_out = len;
+
+    while ((xs->avail_out > 0) && ! ar->ar_eof) {
+        lzma_action act = LZMA_RUN;
+
+        if (xs->avail_in == 0) {
+            if (arc_fill(ar) == 0)
+                act = LZMA_FINISH;
+            xs->next_in  = ar->ar_in;
+            xs->avail_in = ar->ar_in_len;
+        }
+
+        switch (lzma_code(xs, act)) {
+        case LZMA_STREAM_END:
+            ar->ar_eof = true;
+            break;
+
+        case LZMA_OK:
+            break;
+
+        default:
+            arc_error(ar, "xz data error");
+        }
+    }
+
+    return len - xs->avail_out;
+}
+#endif /* ARC_HAVE_XZ */
+
+#ifdef ARC_HAVE_BZIP2
+static size_t
+bzip2_read(arc_rdr_t * ar, unsigned char * buf, size_t len)
+{
+    bz_stream * bs = &ar->ar_u.bs;
+
+    bs->next_out  = (char *)buf;
+    bs->avail_out = len;
+
+    while ((bs->avail_out > 0) && ! ar->ar_eof) {
+        if (bs->avail_in == 0) {
+            if (arc_fill(ar) == 0) {
+                ar->ar_eof = true;
+                break;
+            }
+            bs->next_in  = (char *)ar->ar_in;
+            bs->avail_in = ar->ar_in_len;
+        }
+
+        switch (BZ2_bzDecompress(bs)) {
+        case BZ_STREAM_END:
+            /*
+             * Concatenated bzip2 streams (e.g. from pbzip2).
+             */
+        {
+            char *   nxt = bs->next_in;
+            unsigned ct  = bs->avail_in;
+            BZ2_bzDecompressEnd(bs);
+            if (BZ2_bzDecompressInit(bs, 0, 0) != BZ_OK)
+                arc_error(ar, "bzip2 reinitialization failed");
+            bs->next_in  = nxt;
+            bs->avail_in = ct;
+            break;
+        }
+
+        case BZ_OK:
+            break;
+
+        default:
+            arc_error(ar, "bzip2 data error");
+        }
+    }
+
+    return len - bs->avail_out;
+}
+#endif /* ARC_HAVE_BZIP2 */
+
+/**
+ * Read exactly "len" decompressed bytes, unless the archive ends first.
+ */
+static size_t
+arc_read(arc_rdr_t * ar, void * buf, size_t len)
+{
+    switch (ar->ar_kind) {
+#ifdef ARC_HAVE_GZIP
+    case ARC_GZIP:  return gzip_read( ar, buf, len);
+#endif
+#ifdef ARC_HAVE_XZ
+    case ARC_XZ:    return xz_read(   ar, buf, len);
+#endif
+#ifdef ARC_HAVE_BZIP2
+    case ARC_BZIP2: return bzip2_read(ar, buf, len);
+#endif
+    default:        return plain_read(ar, buf, len);
+    }
+}
+
+static bool
+arc_skip(arc_rdr_t * ar, size_t len)
+{
+    unsigned char scratch[8 * TAR_BLOCK];
+
+    while (len > 0) {
+        size_t ct = (len > sizeof(scratch)) ? sizeof(scratch) : len;
+        if (arc_read(ar, scratch, ct) != ct)
+            return false;
+        len -= ct;
+    }
+    return true;
+}
+
+/**
+ * Figure out the compression from the magic bytes at the start
+ * of the file and set up the matching decompressor.
+ */
+static bool
+arc_open(arc_rdr_t * ar)
+{
+    static char const * const kind_names[] = {
+#define _Atbl_(_e, _s) [_e] = _s,
+        ARC_KIND_TABLE
+#undef  _Atbl_
+    };
+    unsigned char const * p = ar->ar_in;
+    size_t ct = arc_fill(ar);
+
+    if ((ct >= 2) && (p[0] == 0x1F) && (p[1] == 0x8B))
+        ar->ar_kind = ARC_GZIP;
+    else if ((ct >= 6) && (memcmp(p, "\xFD" "7zXZ\0", 6) == 0))
+        ar->ar_kind = ARC_XZ;
+    else if ((ct >= 3) && (memcmp(p, "BZh", 3) == 0))
+        ar->ar_kind = ARC_BZIP2;
+    else
+        ar->ar_kind = ARC_PLAIN;
+    char const * kind_name = kind_names[ar->ar_kind];
+
+    switch (ar->ar_kind) {
+    case ARC_PLAIN:
+        return true;
+
+#ifdef ARC_HAVE_GZIP
+    case ARC_GZIP:
+        ar->ar_u.zs = (z_stream) {
+            .next_in  = ar->ar_in,
+            .avail_in = ct
+        };
+        /*
+         * 16 + MAX_WBITS selects gzip framing.
+         */
+        return inflateInit2(&ar->ar_u.zs, 16 + MAX_WBITS) == Z_OK;
+#endif
+
+#ifdef ARC_HAVE_XZ
+    case ARC_XZ:
+        ar->ar_u.xs = (lzma_stream)LZMA_STREAM_INIT;
+        ar->ar_u.xs.next_in  = ar->ar_in;
+        ar->ar_u.xs.avail_in = ct;
+        return lzma_stream_decoder(&ar->ar_u.xs, UINT64_MAX,
+                                   LZMA_CONCATENATED) == LZMA_OK;
+#endif
+
+#ifdef ARC_HAVE_BZIP2
+    case ARC_BZIP2:
+        ar->ar_u.bs = (bz_stream) {
+            .next_in  = (char *)ar->ar_in,
+            .avail_in = ct
+        };
+        return BZ2_bzDecompressInit(&ar->ar_u.bs, 0, 0) == BZ_OK;
+#endif
+
+    default:
+        fprintf(stderr, "archive %s: %s compression is not supported "
+                "by this build\n", ar->ar_fname, kind_name);
+        return false;
+    }
+}
+
+static void
+arc_close(arc_rdr_t * ar)
+{
+    switch (ar->ar_kind) {
+#ifdef ARC_HAVE_GZIP
+    case ARC_GZIP:  inflateEnd(&ar->ar_u.zs);          break;
+#endif
+#ifdef ARC_HAVE_XZ
+    case ARC_XZ:    lzma_end(&ar->ar_u.xs);            break;
+#endif
+#ifdef ARC_HAVE_BZIP2
+    case ARC_BZIP2: BZ2_bzDecompressEnd(&ar->ar_u.bs); break;
+#endif
+    default: break;
+    }
+    fclose(ar->ar_fp);
+}
+
+/**
+ * tar numeric fields are NUL or space terminated octal, or, for large
+ * values, big-endian binary flagged by the high bit of the first byte.
+ */
+static unsigned long long
+tar_number(unsigned char const * p, int len)
+{
+    unsigned long long res = 0;
+
+    if (*p & 0x80) {
+        res = *(p++) & 0x7F;
+        while (--len > 0)
+            res = (res << 8) | *(p++);
+        return res;
+    }
+
+    while ((len > 0) && (*p == ' ')) p++, len--;
+    while ((len-- > 0) && (*p >= '0') && (*p <= '7'))
+        res = (res << 3) | (*(p++) - '0');
+    return res;
+}
+
+static bool
+tar_cksum_ok(unsigned char const * hdr)
+{
+    unsigned long sum = 0;
+
+    for (int ix = 0; ix < TAR_BLOCK; ix++)
+        sum += ((ix >= TAR_CKSUM_OFF) && (ix < TAR_CKSUM_OFF + TAR_CKSUM_LEN))
+            ? ' ' : hdr[ix];
+
+    return sum == tar_number(hdr + TAR_CKSUM_OFF, TAR_CKSUM_LEN);
+}
+
+static bool
+is_source_name(char const * name)
+{
+    size_t len = strlen(name);
+    return (len > 2) && (name[len - 2] == '.')
+        && ((name[len - 1] == 'c') || (name[len - 1] == 'h'));
+}
+
+/**
+ * Find the "path" record in a pax extended header.
+ * Records look like "<len> path=<value>\n".
+ */
+static char *
+pax_path(char * rec, size_t len)
+{
+    char * end = rec + len;
+
+    while (rec < end) {
+        char * nxt;
+        unsigned long rlen = strtoul(rec, &nxt, 10);
+
+        if ((rlen == 0) || (*nxt != ' ') || (rlen > (size_t)(end - rec)))
+            break;
+        if (strncmp(nxt + 1, "path=", 5) == 0) {
+            rec[rlen - 1] = NUL; // replaces the newline
+            return nxt + 6;
+        }
+        rec += rlen;
+    }
+    return NULL;
+}
+
+/**
+ * Grow a buffer to hold at least "need" bytes.
+ */
+static char *
+grow_buf(char * buf, size_t * sz, size_t need)
+{
+    if (need <= *sz)
+        return buf;
+
+    need = (need + 0xFFFF) & ~(size_t)0xFFFF;
+    mem_account(MEM_TEXT, need - *sz);
+    *sz = need;
+    buf = realloc(buf, *sz);
+    if (buf == NULL)
+        die(COMPLEXITY_EXIT_NOMEM, nomem_fmt, (int)*sz);
+    return buf;
+}
+
+static complexity_exit_code_t
+tar_walk(arc_rdr_t * ar)
+{
+    complexity_exit_code_t res = COMPLEXITY_EXIT_SUCCESS;
+    unsigned char hdr[TAR_BLOCK];
+    char    name[TAR_PREFIX_LEN + TAR_NAME_LEN + 2];
+    char *  text      = NULL;   //!< member contents
+    size_t  text_sz   = 0;
+    char *  long_name = NULL;   //!< GNU long name or pax path
+    char *  ln_buf    = NULL;
+    size_t  ln_sz     = 0;
+
+    for (;;) {
+        if (arc_read(ar, hdr, TAR_BLOCK) != TAR_BLOCK) {
+            arc_error(ar, "truncated tar archive");
+            break;
+        }
+
+        if (hdr[0] == NUL)
+            break; // end of archive marker
+
+        if (! tar_cksum_ok(hdr)) {
+            arc_error(ar, "not a tar archive or corrupt header");
+            break;
+        }
+
+        size_t size   = tar_number(hdr + TAR_SIZE_OFF, TAR_SIZE_LEN);
+        size_t padded = (size + TAR_BLOCK - 1) & ~(size_t)(TAR_BLOCK - 1);
+
+        if (padded < size) {
+            arc_error(ar, "corrupt tar header: bad member size");
+            break;
+        }
+
+        switch (hdr[TAR_TYPE_OFF]) {
+        case 'L': // GNU long name for the next member
+        case 'x': // pax extended header for the next member
+            if (size > TAR_MAX_LNAME) {
+                arc_error(ar, "corrupt tar header: long name too large");
+                goto done;
+            }
+            ln_buf = grow_buf(ln_buf, &ln_sz, padded + 1);
+            if (arc_read(ar, ln_buf, padded) != padded) {
+                arc_error(ar, "truncated tar archive");
+                goto done;
+            }
+            ln_buf[size] = NUL;
+            long_name = (hdr[TAR_TYPE_OFF] == 'L')
+                ? ln_buf : pax_path(ln_buf, size);
+            continue;
+
+        case '0':
+        case '7':
+        case NUL:
+            break;
+
+        default: // directories, links, devices, global pax headers
+            if (! arc_skip(ar, padded)) {
+                arc_error(ar, "truncated tar archive");
+                goto done;
+            }
+            long_name = NULL;
+            continue;
+        }
+
+        if (long_name == NULL) {
+            char const * pfx = (char const *)hdr + TAR_PREFIX_OFF;
+            int ct = 0;
+            if (*pfx != NUL)
+                ct = snprintf(name, sizeof(name), "%.*s/",
+                              TAR_PREFIX_LEN, pfx);
+            snprintf(name + ct, sizeof(name) - ct, "%.*s",
+                     TAR_NAME_LEN, (char const *)hdr + TAR_NAME_OFF);
+        }
+
+        if (! is_source_name(long_name ? long_name : name)) {
+            if (! arc_skip(ar, padded)) {
+                arc_error(ar, "truncated tar archive");
+                goto done;
+            }
+            long_name = NULL;
+            continue;
+        }
+
+        if (size > TAR_MAX_TEXT) {
+            arc_error(ar, "corrupt tar header: member too large");
+            break;
+        }
+
+        text = grow_buf(text, &text_sz, padded + 1);
+        if (arc_read(ar, text, padded) != padded) {
+            arc_error(ar, "truncated tar archive");
+            break;
+        }
+        text[size] = NUL;
+
+        res |= complex_eval_text(long_name ? long_name : name, text);
+        long_name = NULL;
+    }
+
+ done:
+
+    free(text);
+    mem_account(MEM_TEXT, -(long)text_sz);
+    free(ln_buf);
+    mem_account(MEM_TEXT, -(long)ln_sz);
+    if (ar->ar_err)
+        res |= COMPLEXITY_EXIT_BAD_FILE;
+    return res;
+}
+
+static complexity_exit_code_t
+archive_eval_one(char const * fname)
+{
+    complexity_exit_code_t res;
+    arc_rdr_t * ar = calloc(1, sizeof(*ar));
+
+    if (ar == NULL)
+        die(COMPLEXITY_EXIT_NOMEM, nomem_fmt, (int)sizeof(*ar));
+
+    ar->ar_fname = fname;
+    ar->ar_fp    = fopen(fname, "r");
+    if (ar->ar_fp == NULL) {
+        fprintf(stderr, arc_err_fmt, fname, strerror(errno));
+        free(ar);
+        return COMPLEXITY_EXIT_BAD_FILE;
+    }
+
+    if (! arc_open(ar)) {
+        fclose(ar->ar_fp);
+        free(ar);
+        return COMPLEXITY_EXIT_BAD_FILE;
+    }
+
+    res = tar_walk(ar);
+    arc_close(ar);
+    free(ar);
+    return res;
+}
+
+/**
+ * Score the C sources in every --archive file.
+ */
+complexity_exit_code_t
+archive_eval(void)
+{
+    complexity_exit_code_t res = COMPLEXITY_EXIT_SUCCESS;
+    int ct = STACKCT_OPT(ARCHIVE);
+    char const ** al = STACKLST_OPT(ARCHIVE);
+    metric_phase_t phase = metrics_phase(MP_READ);
+
+    while (ct-- > 0)
+        res |= archive_eval_one(*(al++));
+
+    metrics_phase(phase);
+    return res;
+}
+/*
+ * Local Variables:
+ * mode: C
+ * c-file-style: "stroustrup"
+ * indent-tabs-mode: nil
+ * End:
+ * end of archive.c */
@@ -0,0 +1,209 @@
+
+/*
+ *  This file is part of Complexity.
+ *  Complexity Copyright (c) 2011-2020 by Bruce Korb - all rights reserved
+ *
+ *  Complexity is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Complexity is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Micro-benchmarks for the tokenizer and the score handlers, built and
+ * run by "make bench".  Each case is a snippet repeated to fill a text
+ * buffer.  The buffer is tokenized (or scored) over and over until
+ * enough time has passed to give a steady cost per token (or per
+ * construct).  The usual options are accepted, so that the scoring
+ * factors can be changed.
+ *
+ * The build renames the program's own main() so that this one is used.
+ */
+
+#include "opts.h"
+#include <stdlib.h>
+#include <time.h>
+
+#undef main
+
+#define BENCH_TEXT_SIZE (64 * 1024)
+#define BENCH_SECONDS   0.25
+
+static char const nomem_fmt[] = "could not allocate %d bytes\n";
+
+typedef struct {
+    char const *    bc_name;
+    char const *    bc_text;
+} bench_case_t;
+
+static bench_case_t const token_cases[] = {
+    { "names",          "alpha Beta_2 _gamma $delta " },
+    { "keywords",       "if else for while switch case " },
+    { "lower case names", "count index value total " },
+    { "numbers",        "0 42 0x1F 1000000UL " },
+    { "operators",      "+ -= << >>= && || -> != ... " },
+    { "punctuation",    "( ) [ ] { } ; , ? : " },
+    { "strings",        "\"a string\" 'c' \"esc\\\"aped\" " },
+    { "comments",       "/* comment */ x // line comment\n" },
+    { "directives",     "#define X 1\nx\n" },
+};
+
+/*
+ * Each snippet starts with the token that the handler's caller reads.
+ */
+static bench_case_t const handler_cases[] = {
+    { "handle_expression",  "x = a * (b + c) - f(d, e[2]);\n" },
+    { "handle_subexpr",     "(a && b || c == d)\n" },
+    { "handle_TKN_KW_IF",   "if (a > b) { c = d; } else e++;\n" },
+    { "handle_TKN_KW_FOR",  "for (i = 0; i < n; i++) sum += v[i];\n" },
+    { "handle_TKN_KW_CASE", "case FOO + 1:\n" },
+};
+
+#define CASE_CT(_a) ((int)(sizeof(_a) / sizeof(_a[0])))
+
+static double
+now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+
+/**
+ * Repeat a snippet to fill a buffer.  A final ";" gives the last
+ * construct something to look ahead at.
+ */
+static char *
+fill_text(char const * snippet, int * copies)
+{
+    size_t len = strlen(snippet);
+    int    ct  = (BENCH_TEXT_SIZE + len - 1) / len;
+    size_t sz  = ct * len + sizeof(";\n");
+    char * text = malloc(sz);
+    char * p = text;
+
+    if (text == NULL)
+        die(COMPLEXITY_EXIT_NOMEM, nomem_fmt, (int)sz);
+
+    for (int ix = 0; ix < ct; ix++, p += len)
+        memcpy(p, snippet, len);
+    memcpy(p, ";\n", sizeof(";\n"));
+
+    *copies = ct;
+    return text;
+}
+
+static void
+start_text(fstate_t * fs, char const * text)
+{
+    *fs = (fstate_t) {
+        .fs_fname = "bench",
+        .fs_text  = text,
+        .fs_scan  = text,
+        .fs_bol   = true,
+        .last_tkn = TKN_EOF,
+        .cur_line = 1
+    };
+}
+
+static void
+bench_tokens(bench_case_t const * bc)
+{
+    int           copies;
+    char *        text   = fill_text(bc->bc_text, &copies);
+    unsigned long tkn_ct = 0;
+    double        start, elapsed;
+    fstate_t      fs;
+
+    start_text(&fs, text); // warm up
+    while (next_token(&fs) != TKN_EOF)  ;
+
+    start = now();
+    do  {
+        start_text(&fs, text);
+        while (next_token(&fs) != TKN_EOF)
+            tkn_ct++;
+        elapsed = now() - start;
+    } while (elapsed < BENCH_SECONDS);
+
+    printf("  %-22s %10.2f\n", bc->bc_name, elapsed * 1e9 / tkn_ct);
+    free(text);
+}
+
+static void
+bench_handlers_run(bench_case_t const * bc)
+{
+    bench_handler_t const * bh = bench_handlers;
+    int           copies;
+    char *        text;
+    unsigned long done = 0;
+    double        start, elapsed;
+    fstate_t      fs;
+    state_t       sc;
+
+    while (strcmp(bh->bh_name, bc->bc_name) != 0)
+        if ((++bh)->bh_name == NULL)
+            die(COMPLEXITY_EXIT_ASSERT, "no handler named %s\n",
+                bc->bc_name);
+
+    text  = fill_text(bc->bc_text, &copies);
+    start = now();
+    for (int pass = 0;; pass++) {
+        start_text(&fs, text);
+        sc = (state_t) {
+            .st_fstate = &fs,
+            .st_end    = text + strlen(text),
+            .pname     = "bench"
+        };
+
+        if (! bench_handler(bh, &sc, copies))
+            die(COMPLEXITY_EXIT_ASSERT, "%s could not score:  %s",
+                bc->bc_name, bc->bc_text);
+
+        if (pass == 0) { // warm up
+            start = now();
+            continue;
+        }
+
+        done   += copies;
+        elapsed = now() - start;
+        if (elapsed >= BENCH_SECONDS)
+            break;
+    }
+
+    printf("  %-22s %10.2f\n", bc->bc_name, elapsed * 1e9 / done);
+    free(text);
+}
+
+int
+main(int argc, char ** argv)
+{
+    int ct = optionProcess(&complexityOptions, argc, argv);
+
+    initialize(argc - ct, argv + ct);
+
+    printf("%-24s %10s\n", "Tokenizer", "ns/token");
+    for (int ix = 0; ix < CASE_CT(token_cases); ix++)
+        bench_tokens(token_cases + ix);
+
+    printf("\n%-24s %10s\n", "Score handlers", "ns/construct");
+    for (int ix = 0; ix < CASE_CT(handler_cases); ix++)
+        bench_handlers_run(handler_cases + ix);
+
+    return COMPLEXITY_EXIT_SUCCESS;
+}
+/*
+ * Local Variables:
+ * mode: C
+ * c-file-style: "stroustrup"
+ * indent-tabs-mode: nil
+ * End:
+ * end of bench.c */
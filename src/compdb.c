@@ -0,0 +1,504 @@
+
+/*
+ *  This file is part of Complexity.
+ *  Complexity Copyright (c) 2011-2020 by Bruce Korb - all rights reserved
+ *
+ *  Complexity is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Complexity is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Read a compile_commands.json compilation database.  Each entry's
+ * -D and -U flags become the unifdef arguments for that file.
+ * Entries naming the same file with the same effective flags are
+ * scored only once.
+ */
+
+#include "opts.h"
+#include <stdlib.h>
+
+typedef struct {
+    char *          ce_file;    //!< file name, relative to cwd
+    char **         ce_defs;    //!< -D/-U arguments, sorted by symbol
+    int             ce_def_ct;
+    char *          ce_key;     //!< file name and flags, for de-duping
+} cdb_ent_t;
+
+typedef struct {
+    char const *    cp_fname;
+    char const *    cp_text;
+    char const *    cp_scan;
+    bool            cp_err;
+} cdb_parse_t;
+
+static char const nomem_fmt[] = "could not allocate %d bytes\n";
+
+static void *
+cdb_alloc(void * p, size_t sz)
+{
+    p = realloc(p, sz);
+    if (p == NULL)
+        die(COMPLEXITY_EXIT_NOMEM, nomem_fmt, (int)sz);
+    return p;
+}
+
+static void
+cdb_error(cdb_parse_t * cp, char const * what)
+{
+    if (! cp->cp_err)
+        fprintf(stderr, "compdb %s: %s at offset %d\n", cp->cp_fname, what,
+                (int)(cp->cp_scan - cp->cp_text));
+    cp->cp_err = true;
+}
+
+static char
+cdb_next(cdb_parse_t * cp)
+{
+    cp->cp_scan = SPN_SPACE_CHARS(cp->cp_scan);
+    return *cp->cp_scan;
+}
+
+static bool
+cdb_expect(cdb_parse_t * cp, char ch)
+{
+    if (cdb_next(cp) != ch) {
+        char msg[] = "expected ' '";
+        msg[10] = ch;
+        cdb_error(cp, msg);
+        return false;
+    }
+    cp->cp_scan++;
+    return true;
+}
+
+/**
+ * Decode a JSON string.  Non-ASCII \u escapes are replaced with '?',
+ * which cannot matter for file names and preprocessor flags we care about.
+ */
+static char *
+cdb_string(cdb_parse_t * cp)
+{
+    char const * s;
+    char * res;
+    char * d;
+
+    if (! cdb_expect(cp, DQUOT))
+        return NULL;
+
+    s = cp->cp_scan;
+    while ((*s != DQUOT) && (*s != NUL))
+        s += (*s == BSLASH) && (s[1] != NUL) ? 2 : 1;
+    if (*s == NUL) {
+        cdb_error(cp, "unterminated string");
+        return NULL;
+    }
+
+    d = res = cdb_alloc(NULL, (s - cp->cp_scan) + 1);
+
+    for (s = cp->cp_scan; *s != DQUOT; s++) {
+        if (*s != BSLASH) {
+            *(d++) = *s;
+            continue;
+        }
+
+        switch (*++s) {
+        case 'b': *(d++) = '\b'; break;
+        case 'f': *(d++) = FF;   break;
+        case 'n': *(d++) = NL;   break;
+        case 'r': *(d++) = CR;   break;
+        case 't': *(d++) = HT;   break;
+        case 'u':
+        {
+            unsigned long ch = 0;
+            int ix = 0;
+            for (; (ix < 4) && isxdigit((unsigned char)s[1]); ix++) {
+                char hx[2] = { *++s, NUL };
+                ch = (ch << 4) | strtoul(hx, NULL, 16);
+            }
+            *(d++) = (ch < 0x80) ? (char)ch : '?';
+            break;
+        }
+        default:  *(d++) = *s;   break;
+        }
+    }
+
+    *d = NUL;
+    cp->cp_scan = s + 1;
+    return res;
+}
+
+/**
+ * Skip over any JSON value we have no interest in.
+ */
+static void
+cdb_skip_value(cdb_parse_t * cp)
+{
+    int depth = 0;
+
+    do  {
+        switch (cdb_next(cp)) {
+        case DQUOT:
+            free(cdb_string(cp));
+            break;
+
+        case '[': case '{':
+            depth++;
+            cp->cp_scan++;
+            break;
+
+        case ']': case '}':
+            depth--;
+            cp->cp_scan++;
+            break;
+
+        case NUL:
+            cdb_error(cp, "unexpected end of file");
+            return;
+
+        default:
+        {
+            /*
+             * Numbers, true, false, null, and separators.  A number may
+             * have a fraction and a signed exponent, as in -1.5e+3.
+             */
+            char const * s = cp->cp_scan + 1;
+
+            for (;; s++) {
+                if (IS_NAME_CHAR(*s) || (*s == '.'))
+                    continue;
+                if (  ((*s == '+') || (*s == '-'))
+                   && ((s[-1] == 'e') || (s[-1] == 'E')))
+                    continue;
+                break;
+            }
+            cp->cp_scan = s;
+        }
+        }
+    } while ((depth > 0) && ! cp->cp_err);
+}
+
+/**
+ * Split a "command" string the way the shell would, more or less.
+ */
+static char **
+split_command(char const * cmd, int * argc)
+{
+    size_t len  = strlen(cmd) + 1;
+    char * buf  = cdb_alloc(NULL, len);
+    char ** av  = cdb_alloc(NULL, (len / 2 + 2) * sizeof(*av));
+    int    ct   = 0;
+
+    av[0] = buf; // freed via av[0], even with no words
+    for (;;) {
+        char q = NUL;
+
+        cmd = SPN_SPACE_CHARS(cmd);
+        if (*cmd == NUL)
+            break;
+
+        av[ct++] = buf;
+        for (; *cmd != NUL; cmd++) {
+            if (q == NUL) {
+                if (IS_SPACE_CHAR(*cmd))
+                    break;
+                if ((*cmd == SQUOT) || (*cmd == DQUOT)) {
+                    q = *cmd;
+                    continue;
+                }
+            } else if (*cmd == q) {
+                q = NUL;
+                continue;
+            }
+
+            if ((*cmd == BSLASH) && (q != SQUOT) && (cmd[1] != NUL))
+                cmd++;
+            *(buf++) = *cmd;
+        }
+        *(buf++) = NUL;
+    }
+
+    *argc = ct;
+    return av;
+}
+
+static int
+cmp_def(void const * a, void const * b)
+{
+    char const * A = *(char const * const *)a + 2;
+    char const * B = *(char const * const *)b + 2;
+    size_t alen = strcspn(A, "=");
+    size_t blen = strcspn(B, "=");
+    int res = strncmp(A, B, (alen < blen) ? alen : blen);
+    return (res != 0) ? res : (int)alen - (int)blen;
+}
+
+/**
+ * Pull the -D and -U options out of a compiler command line.  Later
+ * options for a symbol override earlier ones, just as for the compiler.
+ */
+static void
+collect_defs(cdb_ent_t * ce, int argc, char ** argv)
+{
+    ce->ce_defs   = cdb_alloc(NULL, (argc + 1) * sizeof(*ce->ce_defs));
+    ce->ce_def_ct = 0;
+
+    for (int ix = 0; ix < argc; ix++) {
+        char const * arg = argv[ix];
+        char * def;
+
+        if ((arg[0] != '-') || ((arg[1] != 'D') && (arg[1] != 'U')))
+            continue;
+
+        if (arg[2] != NUL)
+            def = strdup(arg);
+
+        else if (++ix < argc) {
+            def = cdb_alloc(NULL, strlen(argv[ix]) + 3);
+            def[0] = '-';
+            def[1] = arg[1];
+            strcpy(def + 2, argv[ix]);
+
+        } else
+            break;
+
+        if (def == NULL)
+            die(COMPLEXITY_EXIT_NOMEM, nomem_fmt, (int)strlen(arg));
+
+        for (int dx = 0; dx < ce->ce_def_ct; dx++) {
+            if (cmp_def(&def, ce->ce_defs + dx) == 0) {
+                free(ce->ce_defs[dx]);
+                ce->ce_defs[dx] = ce->ce_defs[--ce->ce_def_ct];
+                break;
+            }
+        }
+        ce->ce_defs[ce->ce_def_ct++] = def;
+    }
+
+    qsort(ce->ce_defs, ce->ce_def_ct, sizeof(*ce->ce_defs), cmp_def);
+
+    {
+        size_t len = strlen(ce->ce_file) + 1;
+        char * p;
+
+        for (int ix = 0; ix < ce->ce_def_ct; ix++)
+            len += strlen(ce->ce_defs[ix]) + 1;
+
+        p = ce->ce_key = cdb_alloc(NULL, len);
+        p = stpcpy(p, ce->ce_file);
+        for (int ix = 0; ix < ce->ce_def_ct; ix++) {
+            *(p++) = NL;
+            p = stpcpy(p, ce->ce_defs[ix]);
+        }
+    }
+}
+
+/**
+ * Parse one "{ ... }" database entry.
+ */
+static bool
+cdb_entry(cdb_parse_t * cp, cdb_ent_t * ce)
+{
+    char *  dir     = NULL;
+    char *  file    = NULL;
+    char *  command = NULL;
+    char ** argv    = NULL;
+    int     argc    = 0;
+    bool    split   = false;
+
+    if (! cdb_expect(cp, '{'))
+        return false;
+
+    while ((cdb_next(cp) != '}') && ! cp->cp_err) {
+        char * key = cdb_string(cp);
+        if ((key == NULL) || ! cdb_expect(cp, ':')) {
+            free(key);
+            break;
+        }
+
+        if (strcmp(key, "directory") == 0)
+            dir = cdb_string(cp);
+        else if (strcmp(key, "file") == 0)
+            file = cdb_string(cp);
+        else if (strcmp(key, "command") == 0)
+            command = cdb_string(cp);
+
+        else if ((strcmp(key, "arguments") == 0) && cdb_expect(cp, '[')) {
+            while ((cdb_next(cp) != ']') && ! cp->cp_err) {
+                argv = cdb_alloc(argv, (argc + 1) * sizeof(*argv));
+                argv[argc] = cdb_string(cp);
+                if (argv[argc] == NULL)
+                    break;
+                argc++;
+                if (cdb_next(cp) == ',')
+                    cp->cp_scan++;
+            }
+            cp->cp_scan++;
+
+        } else
+            cdb_skip_value(cp);
+
+        free(key);
+        if (cdb_next(cp) == ',')
+            cp->cp_scan++;
+    }
+    cp->cp_scan++;
+
+    if ((file == NULL) && ! cp->cp_err)
+        cdb_error(cp, "entry has no \"file\"");
+
+    if (! cp->cp_err) {
+        if ((argv == NULL) && (command != NULL)) {
+            argv  = split_command(command, &argc);
+            split = true;
+        }
+
+        if ((file[0] == FSLASH) || (dir == NULL))
+            ce->ce_file = strdup(file);
+        else {
+            ce->ce_file = cdb_alloc(NULL, strlen(dir) + strlen(file) + 2);
+            sprintf(ce->ce_file, "%s/%s", dir, file);
+        }
+        if (ce->ce_file == NULL)
+            die(COMPLEXITY_EXIT_NOMEM, nomem_fmt, (int)strlen(file));
+
+        collect_defs(ce, argc, argv);
+    }
+
+    if (split)
+        free(argv[0]); // the split buffer
+    else {
+        for (int ix = 0; ix < argc; ix++)
+            free(argv[ix]);
+    }
+    free(argv);
+    free(command);
+    free(file);
+    free(dir);
+
+    return ! cp->cp_err;
+}
+
+static int
+cmp_ent(void const * a, void const * b)
+{
+    return strcmp(((cdb_ent_t const *)a)->ce_key,
+                  ((cdb_ent_t const *)b)->ce_key);
+}
+
+static char *
+cdb_load(char const * fname)
+{
+    FILE * fp = fopen(fname, "r");
+    char * text;
+    long   sz;
+
+    if (  (fp == NULL)
+       || (fseek(fp, 0, SEEK_END) != 0)
+       || ((sz = ftell(fp)) < 0)
+       || (fseek(fp, 0, SEEK_SET) != 0)) {
+        fprintf(stderr, "compdb %s: %s\n", fname, strerror(errno));
+        if (fp != NULL)
+            fclose(fp);
+        return NULL;
+    }
+
+    text = cdb_alloc(NULL, sz + 1);
+    text[fread(text, 1, sz, fp)] = NUL;
+    fclose(fp);
+    return text;
+}
+
+static complexity_exit_code_t
+compdb_eval_one(char const * fname)
+{
+    complexity_exit_code_t res = COMPLEXITY_EXIT_SUCCESS;
+    cdb_parse_t cp = { .cp_fname = fname };
+    cdb_ent_t * ents = NULL;
+    int         ent_ct = 0;
+
+    cp.cp_text = cp.cp_scan = cdb_load(fname);
+    if (cp.cp_text == NULL)
+        return COMPLEXITY_EXIT_BAD_FILE;
+
+    if (cdb_expect(&cp, '[')) {
+        while ((cdb_next(&cp) != ']') && ! cp.cp_err) {
+            ents = cdb_alloc(ents, (ent_ct + 1) * sizeof(*ents));
+            if (! cdb_entry(&cp, ents + ent_ct))
+                break;
+            ent_ct++;
+            if (cdb_next(&cp) == ',')
+                cp.cp_scan++;
+        }
+    }
+
+    if (cp.cp_err)
+        res = COMPLEXITY_EXIT_BAD_FILE;
+
+    /*
+     * Sort so that duplicate file + flag combinations are adjacent
+     * and score only the first of each.
+     */
+    qsort(ents, ent_ct, sizeof(*ents), cmp_ent);
+
+    for (int ix = 0; ix < ent_ct; ix++) {
+        cdb_ent_t * ce = ents + ix;
+
+        if ((ix > 0) && (strcmp(ce->ce_key, ce[-1].ce_key) == 0))
+            ce->ce_file[0] = NUL; // duplicate
+        else if (ce->ce_def_ct > 0)
+            unif_queue(ce->ce_file, ce->ce_def_ct,
+                       (char const * const *)ce->ce_defs);
+    }
+
+    for (int ix = 0; ix < ent_ct; ix++) {
+        cdb_ent_t * ce = ents + ix;
+
+        if (ce->ce_file[0] != NUL)
+            res |= complex_eval_defs(ce->ce_file, ce->ce_def_ct,
+                                     (char const * const *)ce->ce_defs);
+    }
+
+    for (int ix = 0; ix < ent_ct; ix++) {
+        for (int dx = 0; dx < ents[ix].ce_def_ct; dx++)
+            free(ents[ix].ce_defs[dx]);
+        free(ents[ix].ce_defs);
+        free(ents[ix].ce_file);
+        free(ents[ix].ce_key);
+    }
+    free(ents);
+    free((void *)cp.cp_text);
+    return res;
+}
+
+/**
+ * Score the files listed in every --compdb database.
+ */
+complexity_exit_code_t
+compdb_eval(void)
+{
+    complexity_exit_code_t res = COMPLEXITY_EXIT_SUCCESS;
+    int ct = STACKCT_OPT(COMPDB);
+    char const ** cl = STACKLST_OPT(COMPDB);
+
+    while (ct-- > 0)
+        res |= compdb_eval_one(*(cl++));
+
+    return res;
+}
+/*
+ * Local Variables:
+ * mode: C
+ * c-file-style: "stroustrup"
+ * indent-tabs-mode: nil
+ * End:
+ * end of compdb.c */
@@ -20,18 +20,22 @@
 #define _GNU_SOURCE 1
 
 #include "opts.h"
+#include <fcntl.h>
+#include <fnmatch.h>
 #include <limits.h>
 #include <math.h>
-#include <regex.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <unistd.h>
 
-#ifndef UNIFDEF_EXE
-#define UNIFDEF_EXE "unifdef"
-#endif
-
 #define RANGE_LIMIT 2000
 
+/*
+ * Read size for --stream.  The window is twice this, and grows only
+ * when a single procedure will not fit.
+ */
+#define STREAM_BLOCK_SIZE (1024 * 1024)
+
 static score_t score_ttl      = 0;
 static int     ttl_line_ct    = 0;
 static int     unscore_ct     = 0;
@@ -50,9 +54,370 @@ static char const nomem_fmt[] =    "could not allocate %d bytes\n";
 static int     score_alloc_ct = 0;
 static state_t ** scores      = NULL;
 
-static char const * unifcmd = UNIFDEF_EXE;
+/*
+ * Histogram buckets (see hash_score()): non-comment line counts and
+ * procedure counts.  "lines_at" holds the non-comment line count for
+ * each rounded score, for finding the percentiles.
+ */
+static int *   hist_lines     = NULL;
+static int *   hist_procs     = NULL;
+static int     hist_alloc     = 0;
+static int *   lines_at       = NULL;
+static int     lines_at_alloc = 0;
+
+typedef struct {
+    uint64_t        de_hash;        //!< contents and unifdef arguments
+    size_t          de_len;
+    uint64_t        de_fl_hash;     //!< unifdef arguments
+    bool            de_has_ino;
+    dev_t           de_dev;
+    ino_t           de_ino;
+    int             de_first;       //!< this file's entries in "scores"
+    int             de_end;
+    char const *    de_fname;
+} dup_ent_t;
+
+static dup_ent_t * dups        = NULL;
+static int         dup_ct      = 0;
+static int *       dup_by_text = NULL;
+static int *       dup_by_ino  = NULL;
+static size_t      dup_mask    = 0;
+static int         fold_ct     = 0;
+static int         file_ord    = 0; //!< ordinal of the current input file
+
 static char high_buf[1024];
 
+/*
+ * The file and line named by --at.
+ */
+static char *  at_fname = NULL;
+static int     at_line  = 0;
+
+/*
+ * Compiled --ignore list.  Plain names go into an open addressed hash
+ * table.  "name*" and "*name" patterns are compared as prefixes and
+ * suffixes and anything else with glob characters goes to fnmatch(3).
+ */
+typedef enum { IGN_PREFIX, IGN_SUFFIX, IGN_GLOB } ign_kind_t;
+
+typedef struct {
+    ign_kind_t      ip_kind;
+    size_t          ip_len;
+    char const *    ip_pat;
+} ign_pat_t;
+
+static char const ** ign_hash      = NULL;
+static size_t        ign_hash_mask = 0;
+static ign_pat_t *   ign_pats      = NULL;
+static int           ign_pat_ct    = 0;
+
+static inline size_t
+hash_name(char const * name, size_t len)
+{
+    size_t res = 2166136261U;
+    while (len-- > 0)
+        res = (res ^ (unsigned char)*(name++)) * 16777619U;
+    return res;
+}
+
+static void
+ign_hash_add(char const * name)
+{
+    size_t len = strlen(name);
+    size_t ix  = hash_name(name, len) & ign_hash_mask;
+
+    while (ign_hash[ix] != NULL) {
+        if (strcmp(ign_hash[ix], name) == 0)
+            return;
+        ix = (ix + 1) & ign_hash_mask;
+    }
+    ign_hash[ix] = name;
+}
+
+static void
+compile_ignores(void)
+{
+    int ct = STACKCT_OPT(IGNORE);
+    char const ** il = STACKLST_OPT(IGNORE);
+    size_t sz;
+
+    /*
+     * Keep the table at most half full.
+     */
+    for (sz = 16; sz < (size_t)ct * 2; sz *= 2)  ;
+    ign_hash_mask = sz - 1;
+    ign_hash = calloc(sz, sizeof(*ign_hash));
+    ign_pats = malloc(ct * sizeof(*ign_pats));
+    if ((ign_hash == NULL) || (ign_pats == NULL))
+        die(COMPLEXITY_EXIT_NOMEM, nomem_fmt,
+            (int)(sz * sizeof(*ign_hash) + ct * sizeof(*ign_pats)));
+
+    for (int ix = 0; ix < ct; ix++) {
+        char const * pat = il[ix];
+        size_t       len = strlen(pat);
+        char const * meta = strpbrk(pat, "*?[\\");
+        ign_pat_t *  ip  = ign_pats + ign_pat_ct;
+
+        if (meta == NULL) {
+            ign_hash_add(pat);
+            continue;
+        }
+
+        if ((len > 1) && (meta == pat + len - 1) && (*meta == '*')) {
+            ip->ip_kind = IGN_PREFIX;
+            ip->ip_pat  = pat;
+            ip->ip_len  = len - 1;
+
+        } else if ((len > 1) && (*pat == '*')
+                   && (strpbrk(pat + 1, "*?[\\") == NULL)) {
+            ip->ip_kind = IGN_SUFFIX;
+            ip->ip_pat  = pat + 1;
+            ip->ip_len  = len - 1;
+
+        } else {
+            ip->ip_kind = IGN_GLOB;
+            ip->ip_pat  = pat;
+            ip->ip_len  = len;
+        }
+        ign_pat_ct++;
+    }
+}
+
+/**
+ * Check a procedure name against the compiled --ignore list.
+ * The name need not be NUL terminated.
+ */
+static bool
+is_ignored(char const * name, size_t len)
+{
+    size_t ix = hash_name(name, len) & ign_hash_mask;
+    char   nmbuf[256];
+
+    for (; ign_hash[ix] != NULL; ix = (ix + 1) & ign_hash_mask) {
+        if (  (strncmp(ign_hash[ix], name, len) == 0)
+           && (ign_hash[ix][len] == NUL))
+            return true;
+    }
+
+    for (ign_pat_t * ip = ign_pats; ip < ign_pats + ign_pat_ct; ip++) {
+        switch (ip->ip_kind) {
+        case IGN_PREFIX:
+            if (  (len >= ip->ip_len)
+               && (memcmp(name, ip->ip_pat, ip->ip_len) == 0))
+                return true;
+            break;
+
+        case IGN_SUFFIX:
+            if (  (len >= ip->ip_len)
+               && (memcmp(name + len - ip->ip_len, ip->ip_pat,
+                          ip->ip_len) == 0))
+                return true;
+            break;
+
+        case IGN_GLOB:
+            if (len >= sizeof(nmbuf))
+                break;
+            memcpy(nmbuf, name, len);
+            nmbuf[len] = NUL;
+            if (fnmatch(ip->ip_pat, nmbuf, 0) == 0)
+                return true;
+            break;
+        }
+    }
+
+    return false;
+}
+
+typedef struct {
+    char *          hn_name;
+    int             hn_score;   //!< worst score seen for the file
+    int             hn_pos;     //!< position on the command line
+} hint_t;
+
+static int
+compare_hint_name(void const * a, void const * b)
+{
+    return strcmp(((hint_t const *)a)->hn_name, ((hint_t const *)b)->hn_name);
+}
+
+static int
+compare_hint_order(void const * a, void const * b)
+{
+    hint_t const * A = a;
+    hint_t const * B = b;
+
+    if (A->hn_score != B->hn_score)
+        return (A->hn_score > B->hn_score) ? -1 : 1;
+    return A->hn_pos - B->hn_pos;
+}
+
+/**
+ * Read the --fail-fast-hints file.  It may be the score listing from an
+ * earlier run, or just a list of file names, worst first.
+ */
+static hint_t *
+load_hints(int * ct_p)
+{
+    FILE *   fp    = fopen(OPT_ARG(FAIL_FAST_HINTS), "r");
+    hint_t * hints = NULL;
+    int      ct    = 0;
+    int      alloc = 0;
+    char *   line  = NULL;
+    size_t   ln_sz = 0;
+    ssize_t  len;
+
+    *ct_p = 0;
+    if (fp == NULL) // no hints yet is fine
+        return NULL;
+
+    while ((len = getline(&line, &ln_sz, fp)) > 0) {
+        int    score, ln_ct, nc_ct, pos = 0;
+        char * name = line;
+
+        while ((len > 0) && isspace((unsigned char)line[len - 1]))
+            line[--len] = NUL;
+        if (len == 0)
+            continue;
+
+        if (  (sscanf(line, "%d %d %d %n", &score, &ln_ct, &nc_ct, &pos) == 3)
+           && (pos > 0)) {
+            char * paren = strrchr(line, '(');
+            if (paren == NULL)
+                continue; // the header or totals
+            *paren = NUL;
+            name   = line + pos;
+        } else
+            score  = INT_MAX - ct; // keep the listed order
+
+        if (ct >= alloc) {
+            alloc += (alloc == 0) ? 256 : alloc;
+            hints  = realloc(hints, alloc * sizeof(*hints));
+            if (hints == NULL)
+                die(COMPLEXITY_EXIT_NOMEM, nomem_fmt,
+                    (int)(alloc * sizeof(*hints)));
+        }
+        hints[ct].hn_name  = strdup(name);
+        hints[ct].hn_score = score;
+        if (hints[ct].hn_name == NULL)
+            die(COMPLEXITY_EXIT_NOMEM, nomem_fmt, (int)strlen(name));
+        ct++;
+    }
+
+    free(line);
+    fclose(fp);
+    *ct_p = ct;
+    return hints;
+}
+
+/**
+ * Move the command line files named in the hints to the front, worst
+ * first, so that --fail-fast finds a horrid function sooner.  The
+ * other files keep their order.
+ */
+static void
+order_by_hints(int argc, char ** argv)
+{
+    int      hint_ct;
+    hint_t * hints = load_hints(&hint_ct);
+    hint_t * found;
+    int      found_ct = 0;
+    char **  rest;
+    int      rest_ct  = 0;
+
+    if (hint_ct == 0)
+        return;
+
+    qsort(hints, hint_ct, sizeof(*hints), compare_hint_name);
+
+    found = malloc(argc * sizeof(*found));
+    rest  = malloc(argc * sizeof(*rest));
+    if ((found == NULL) || (rest == NULL))
+        die(COMPLEXITY_EXIT_NOMEM, nomem_fmt, (int)(argc * sizeof(*found)));
+
+    for (int ix = 0; ix < argc; ix++) {
+        hint_t   key = { .hn_name = argv[ix] };
+        hint_t * hn  = bsearch(&key, hints, hint_ct, sizeof(*hints),
+                               compare_hint_name);
+        if (hn == NULL) {
+            rest[rest_ct++] = argv[ix];
+            continue;
+        }
+
+        /*
+         * The listing has one line per procedure.  The first match is
+         * not necessarily the worst score for the file.
+         */
+        while ((hn > hints) && (strcmp(hn[-1].hn_name, argv[ix]) == 0))
+            hn--;
+        key.hn_score = hn->hn_score;
+        for (; (hn < hints + hint_ct) && (strcmp(hn->hn_name, argv[ix]) == 0);
+             hn++)
+            if (hn->hn_score > key.hn_score)
+                key.hn_score = hn->hn_score;
+
+        key.hn_pos = ix;
+        found[found_ct++] = key;
+    }
+
+    qsort(found, found_ct, sizeof(*found), compare_hint_order);
+    for (int ix = 0; ix < found_ct; ix++)
+        argv[ix] = found[ix].hn_name;
+    memcpy(argv + found_ct, rest, rest_ct * sizeof(*rest));
+
+    for (int ix = 0; ix < hint_ct; ix++)
+        free(hints[ix].hn_name);
+    free(hints);
+    free(found);
+    free(rest);
+}
+
+/**
+ * Report the first procedure over the horrid threshold and quit.
+ */
+static void
+fail_fast(state_t const * pstate)
+{
+    if (! HAVE_OPT(NO_HEADER))
+        fwrite(head_fmt, sizeof(head_fmt) - 1, 1, stdout);
+    printf(line_fmt, (int)(pstate->score + 0.5), pstate->st_line_ct,
+           pstate->st_nc_line_ct, pstate->st_end, pstate->ln_st,
+           pstate->pname);
+    exit(COMPLEXITY_EXIT_HORRID_FUNCTION);
+}
+
+/**
+ * Split the --at argument into its file name and line number.
+ */
+static void
+at_parse(char const * arg)
+{
+    char const * colon = strrchr(arg, ':');
+    char *       end;
+    long         line;
+    size_t       len;
+
+    if ((colon == NULL) || (colon == arg))
+        goto bad_arg;
+
+    line = strtol(colon + 1, &end, 10);
+    if ((*end != NUL) || (end == colon + 1) || (line < 1) || (line > INT_MAX))
+        goto bad_arg;
+
+    len = colon - arg;
+    at_fname = malloc(len + 1);
+    if (at_fname == NULL)
+        die(COMPLEXITY_EXIT_NOMEM, nomem_fmt, (int)len + 1);
+    memcpy(at_fname, arg, len);
+    at_fname[len] = NUL;
+    at_line = line;
+    return;
+
+ bad_arg:
+    fprintf(stderr, "invalid --at location: %s\n"
+            "\tuse the file name and line number, as in file.c:42\n", arg);
+    USAGE(EXIT_FAILURE);
+}
+
 void
 initialize(int argc, char ** argv)
 {
@@ -64,6 +429,29 @@ initialize(int argc, char ** argv)
         USAGE(EXIT_FAILURE);
     }
 
+    if (HAVE_OPT(AT)) {
+        if (argc > 0) {
+            static char const oops[] =
+                "--at names the only file to score.\n";
+            fwrite(oops, sizeof(oops)-1, 1, stderr);
+            USAGE(EXIT_FAILURE);
+        }
+        at_parse(OPT_ARG(AT));
+    }
+
+    /*
+     * With only archives, compilation databases, partial results, a
+     * watched tree, a query or an --at location to process, do not wait
+     * for file names on standard input.
+     */
+    if (  (  HAVE_OPT(ARCHIVE) || HAVE_OPT(COMPDB) || HAVE_OPT(WATCH)
+          || HAVE_OPT(MERGE) || HAVE_OPT(QUERY) || HAVE_OPT(AT))
+       && (argc == 0) && ! HAVE_OPT(INPUT)) {
+        if (freopen("/dev/null", "r", stdin) != stdin)
+            die(COMPLEXITY_EXIT_BAD_FILE, "fs error %d (%s) reopening "
+                "/dev/null as stdin\n", errno, strerror(errno));
+    }
+
     if (! HAVE_OPT(SCORES)) {
         if (! ENABLED_OPT(HISTOGRAM))
             SET_OPT_SCORES;
@@ -75,6 +463,20 @@ initialize(int argc, char ** argv)
             SET_OPT_THRESHOLD(0);
     }
 
+    /*
+     * A procedure asked for by name or location is reported whatever
+     * its score.
+     */
+    if ((HAVE_OPT(FUNCTION) || HAVE_OPT(AT)) && ! HAVE_OPT(THRESHOLD))
+        SET_OPT_THRESHOLD(0);
+
+    if (HAVE_OPT(SUMMARY_ONLY) && ENABLED_OPT(SCORES)) {
+        static char const oops[] =
+            "--summary-only does not keep the scores for --scores.\n";
+        fwrite(oops, sizeof(oops)-1, 1, stderr);
+        USAGE(EXIT_FAILURE);
+    }
+
     if (HAVE_OPT(NESTING_PENALTY)) {
         penalty = atof(OPT_ARG(NESTING_PENALTY));
         if (penalty < 1.0)
@@ -89,20 +491,86 @@ initialize(int argc, char ** argv)
 
     threshold = (score_t)OPT_VALUE_THRESHOLD - 0.5;
 
+    if (HAVE_OPT(IGNORE))
+        compile_ignores();
+
+    if (HAVE_OPT(METRICS_FILE))
+        metrics_start();
+
+    if (HAVE_OPT(MEM_STATS) || HAVE_OPT(MAX_MEMORY))
+        mem_start();
+
+    if (HAVE_OPT(SHARD))
+        shard_start();
+
+    if (HAVE_OPT(ROLLUP))
+        rollup_start();
+
+    if (HAVE_OPT(PROC_BUDGET) || HAVE_OPT(FILE_BUDGET))
+        budget_start();
+
+    if (HAVE_OPT(SAMPLE))
+        sample_start(argc, argv);
+
+    if (HAVE_OPT(FAIL_FAST_HINTS) && (argc > 1))
+        order_by_hints(argc, argv);
+
+    /*
+     * Start unifdef-ing the named files before we need them.
+     */
+    if (HAVE_OPT(UNIFDEF)) {
+        int ct;
+        char const * const * args = unif_global_args(&ct);
+
+        for (int ix = 0; ix < argc; ix++)
+            unif_queue(argv[ix], ct, args);
+    }
+
+    mem_account(MEM_SCORES, 1024 * sizeof(*scores));
     scores = malloc(1024 * sizeof(*scores));
     score_alloc_ct = 1024;
     scaling = (score_t)(HAVE_OPT(SCALE) ? OPT_VALUE_SCALE : DEFAULT_SCALE);
     scaling = 1.0 / scaling;
 }
 
-static inline int
-hash_score(score_t score)
+/**
+ * Add (dir > 0) or remove (dir < 0) a procedure from the histogram
+ * and the percentile tallies.
+ */
+static void
+hist_update(state_t const * pstate, int dir)
 {
-    int sc = score + 0.5;
-    if (sc < 10)   return 0;
-    if (sc < 100)  return sc / 10; // 1 -> 9
-    if (sc < 1000) return 9 + (sc / 100); // 10 -> 18
-    return 18 + (sc / 1000); // 19 -> ...
+    int ix = hash_score(pstate->score);
+    int sc = pstate->score + 0.5;
+
+    if (sc >= lines_at_alloc) {
+        int    ct = sc + (sc / 2) + 128;
+        size_t sz = ct * sizeof(int);
+
+        lines_at = realloc(lines_at, sz);
+        if (lines_at == NULL)
+            die(COMPLEXITY_EXIT_NOMEM, nomem_fmt, (int)sz);
+        memset(lines_at + lines_at_alloc, 0,
+               (ct - lines_at_alloc) * sizeof(int));
+        lines_at_alloc = ct;
+    }
+    lines_at[sc] += dir * pstate->st_nc_line_ct;
+
+    if (ix >= hist_alloc) {
+        int    ct = ix + 32;
+        size_t sz = ct * sizeof(int);
+
+        hist_lines = realloc(hist_lines, sz);
+        hist_procs = realloc(hist_procs, sz);
+        if ((hist_lines == NULL) || (hist_procs == NULL))
+            die(COMPLEXITY_EXIT_NOMEM, nomem_fmt, (int)sz);
+        memset(hist_lines + hist_alloc, 0, (ct - hist_alloc) * sizeof(int));
+        memset(hist_procs + hist_alloc, 0, (ct - hist_alloc) * sizeof(int));
+        hist_alloc = ct;
+    }
+
+    hist_lines[ix] += dir * pstate->st_nc_line_ct;
+    hist_procs[ix] += dir;
 }
 
 static inline bool
@@ -132,17 +600,20 @@ print_histogram(void)
     static char const fmtfmt[] = "%%5d-%%-5d %%7d %%%1$d.%1$ds\n";
     static char const deffmt[] = "%5d-%-5d %7d\n";
 
-    int const score_ix_lim = hash_score(scores[score_ct-1]->score) + 1;
-
-    int * lines_scoring = calloc(score_ix_lim, sizeof(int));
+    int score_ix_lim = hist_alloc;
+    int * lines_scoring = hist_lines;
     int max_ct = 0;
 
-    for (int ix = 0; ix < score_ct; ix++) {
-        int score_ix = hash_score(scores[ix]->score);
+    /*
+     * The buckets are kept up to date as procedures are scored.
+     * Trim the empty ones above the highest score.
+     */
+    while ((score_ix_lim > 1) && (hist_procs[score_ix_lim - 1] == 0))
+        score_ix_lim--;
 
-        lines_scoring[score_ix] += scores[ix]->st_nc_line_ct;
-        if (lines_scoring[score_ix] > max_ct)
-            max_ct = lines_scoring[score_ix];
+    for (int ix = 0; ix < score_ix_lim; ix++) {
+        if (lines_scoring[ix] > max_ct)
+            max_ct = lines_scoring[ix];
     }
 
     if (! HAVE_OPT(NO_HEADER)) {
@@ -194,8 +665,6 @@ print_histogram(void)
         if (put_nl)
             putc(NL, stdout);
     }
-
-    free(lines_scoring);
 }
 
 static void
@@ -223,19 +692,34 @@ print_stats(void)
     int     pctile[5]    = { 0, 0, 0, 0, 0 };
     int     pct_ix       = 0;
     int     counter      = 0;
-    int     ix;
-    int     pct_ct       = ttl_line_ct / 4;
+    int     pct_ct       = (ttl_line_ct < 4) ? 1 : ttl_line_ct / 4;
     int     pct_thresh   = pct_ct;
+    int     top_score    = 0;
 
-    for (ix = 0; ix < score_ct; ix++) {
-        counter += scores[ix]->st_nc_line_ct;
-
-        if (counter >= pct_thresh) {
-            pctile[pct_ix++] = (int)(scores[ix]->score + 0.5);
+    /*
+     * The line counts are tallied by score as procedures are kept,
+     * so this does not depend upon the scores having been sorted.
+     * With fewer than four lines, step through them one at a time.
+     */
+    for (int sc = 0; (sc < lines_at_alloc) && (pct_ix < 4); sc++) {
+        if (lines_at[sc] == 0)
+            continue;
+        counter  += lines_at[sc];
+        top_score = sc;
+
+        while ((counter >= pct_thresh) && (pct_ix < 4)) {
+            pctile[pct_ix++] = sc;
             pct_thresh      += pct_ct;
         }
     }
 
+    /*
+     * With fewer than three lines, the last steps are never reached.
+     * Those percentiles get the highest score tallied.
+     */
+    while (pct_ix < 3)
+        pctile[pct_ix++] = top_score;
+
 #define _St_(_s, _a)  , _a
     printf(summary_fmt SUMMARY_TABLE);
 #undef  _St_
@@ -245,24 +729,102 @@ print_stats(void)
 #undef  SUMMARY_TABLE
 }
 
-static int
-compare_score(void const * a, void const * b)
+/*
+ * Scores are whole numbers no larger than MAX_SCORE, so the report
+ * order (score, then non-comment lines, then lines) is a plain integer
+ * key.  The keys are copied into one array and sorted a byte at a
+ * time, least significant first, skipping any byte that is the same
+ * in every key.  The sort is stable:  ties stay in scoring order.
+ */
+#define SORT_KEY_BYTES 12
+
+typedef struct {
+    uint64_t    sk_hi;          //!< score and non-comment line count
+    uint32_t    sk_lo;          //!< line count
+    uint32_t    sk_ix;          //!< index into "scores"
+} sort_key_t;
+
+static inline unsigned
+sort_key_byte(sort_key_t const * key, int byte)
 {
-    state_t * A = *(void **)a;
-    state_t * B = *(void **)b;
-    int res = (int)(A->score - B->score);
-    if (res != 0)
-        return res;
-    res = A->st_nc_line_ct - B->st_nc_line_ct;
-    if (res != 0)
-        return res;
-    return A->st_line_ct - B->st_line_ct;
+    return (byte < 4)
+        ? (key->sk_lo >> (byte * 8)) & 0xFF
+        : (unsigned)(key->sk_hi >> ((byte - 4) * 8)) & 0xFF;
+}
+
+static void
+sort_scores(void)
+{
+    static size_t byte_ct[SORT_KEY_BYTES][256];
+    size_t       sz  = 2 * score_ct * sizeof(sort_key_t);
+    sort_key_t * key;
+    sort_key_t * tmp;
+
+    if (score_ct < 2)
+        return;
+
+    mem_account(MEM_SCORES, sz);
+    key = malloc(sz);
+    if (key == NULL)
+        die(COMPLEXITY_EXIT_NOMEM, nomem_fmt, (int)sz);
+    tmp = key + score_ct;
+    memset(byte_ct, 0, sizeof(byte_ct));
+
+    for (int ix = 0; ix < score_ct; ix++) {
+        state_t const * st = scores[ix];
+        key[ix] = (sort_key_t) {
+            .sk_hi = ((uint64_t)(uint32_t)st->score << 32)
+                   | (uint32_t)st->st_nc_line_ct,
+            .sk_lo = st->st_line_ct,
+            .sk_ix = ix };
+
+        for (int by = 0; by < SORT_KEY_BYTES; by++)
+            byte_ct[by][sort_key_byte(key + ix, by)]++;
+    }
+
+    for (int by = 0; by < SORT_KEY_BYTES; by++) {
+        size_t * ct  = byte_ct[by];
+        size_t   pos = 0;
+
+        if (ct[sort_key_byte(key, by)] == (size_t)score_ct)
+            continue;
+
+        for (int ix = 0; ix < 256; ix++) {
+            size_t n = ct[ix];
+            ct[ix]   = pos;
+            pos     += n;
+        }
+
+        for (int ix = 0; ix < score_ct; ix++)
+            tmp[ct[sort_key_byte(key + ix, by)]++] = key[ix];
+
+        sort_key_t * sw = key;
+        key = tmp;
+        tmp = sw;
+    }
+
+    /*
+     * The spare half of the key buffer holds the reordered pointers.
+     */
+    {
+        state_t ** sorted = (state_t **)tmp;
+
+        for (int ix = 0; ix < score_ct; ix++)
+            sorted[ix] = scores[key[ix].sk_ix];
+        memcpy(scores, sorted, score_ct * sizeof(*scores));
+    }
+
+    free((key < tmp) ? key : tmp);
+    mem_account(MEM_SCORES, -(long)sz);
 }
 
 void
 do_summary(complexity_exit_code_t exit_code)
 {
-    qsort(scores, score_ct, sizeof(state_t *), compare_score);
+    metric_phase_t phase = metrics_phase(MP_REPORT);
+
+    if (! HAVE_OPT(SUMMARY_ONLY))
+        sort_scores();
     if (ENABLED_OPT(SCORES)) {
         if (! HAVE_OPT(NO_HEADER))
             fwrite(head_fmt, sizeof(head_fmt) - 1, 1, stdout);
@@ -280,81 +842,176 @@ do_summary(complexity_exit_code_t exit_code)
 
     } else if (! HAVE_OPT(NO_HEADER))
         printf(lnct_fmt, ttl_line_ct);
+
+    if ((fold_ct > 0) && ! HAVE_OPT(NO_HEADER))
+        printf("Folded duplicate files: %5d\n", fold_ct);
+    if (HAVE_OPT(SAMPLE))
+        sample_report();
+    if (HAVE_OPT(ROLLUP))
+        rollup_print();
+    if (HAVE_OPT(DUP_FUNCTIONS))
+        memo_report();
+    metrics_phase(phase);
 }
 
-static FILE *
-popen_unifdef(char const * fname)
+/**
+ * Point the file state at a NUL terminated text buffer and reset
+ * the scanning state.
+ */
+static void
+set_text(fstate_t * fs, char const * text)
 {
-    static char const * cmd = NULL;
-    static size_t       cmdlen = 0;
-
-    if (cmd == NULL) {
-        int ct = STACKCT_OPT(UNIFDEF);
-        char const * const * ov = STACKLST_OPT(UNIFDEF);
-        char * buf;
-        size_t len;
+    fs->fs_text  = fs->fs_scan = text;
+    fs->cur_line = 1;
+    fs->nc_line  = 0;
+    fs->fs_bol   = true;
+    fs->last_tkn = TKN_EOF;
+    if (HAVE_OPT(TRACE))
+        fprintf(trace_fp, "\nLoading file %s\n", fs->fs_fname);
+}
 
-        /*
-         * Select the correct unifdef command and add one to the length:
-         * for NUL termination.  Then add up the lengths of the arguments
-         * and space separations we need.
-         */
-        if (HAVE_OPT(UNIF_EXE))
-            unifcmd = OPT_ARG(UNIF_EXE);
-        len = cmdlen = strlen(unifcmd) + 1;
+/*
+ * The text buffer is kept for the next file instead of being freed, and
+ * grows only when a file does not fit.  Once it has grown to fit the
+ * biggest file, reading a file allocates nothing.  It stays accounted
+ * as MEM_TEXT while it is kept.
+ */
+static char *  text_buf      = NULL;
+static size_t  text_buf_size = 0;
 
-        for (int i = 0; i < ct; i++)
-            len += 1 + strlen(ov[i]);
+/**
+ * Take the kept text buffer, grown to at least "sz" bytes.
+ */
+static char *
+text_buf_get(size_t sz, size_t * buf_sz)
+{
+    char * buf = text_buf;
 
-        cmd = buf = malloc(len);
+    if (sz > text_buf_size) {
+        mem_account(MEM_TEXT, sz - text_buf_size);
+        buf = realloc(buf, sz);
         if (buf == NULL)
-            die(COMPLEXITY_EXIT_NOMEM, nomem_fmt, len);
+            die(COMPLEXITY_EXIT_NOMEM, nomem_fmt, (int)sz);
+        text_buf_size = sz;
+    }
 
-        /*
-         * Now assemble the command
-         */
-        memcpy(buf, unifcmd, cmdlen);
-        buf += cmdlen - 1;
-
-        while (ct-- > 0) {
-            char const * p = *(ov++);
-            *(buf++) = ' ';
-            len = strlen(p);
-            memcpy(buf, p, len);
-            buf += len;
-        }
-        *buf   = NUL;
-        cmdlen = (buf - cmd) + 2;
+    *buf_sz  = text_buf_size;
+    text_buf = NULL;
+    return buf;
+}
+
+/**
+ * Grow a buffer taken with text_buf_get().
+ */
+static char *
+text_buf_grow(char * buf, size_t * buf_sz, size_t sz)
+{
+    mem_account(MEM_TEXT, sz - *buf_sz);
+    buf = realloc(buf, sz);
+    if (buf == NULL)
+        die(COMPLEXITY_EXIT_NOMEM,
+            "reallocation of %d to %d bytes failed\n", (int)*buf_sz, (int)sz);
+    *buf_sz = text_buf_size = sz;
+    return buf;
+}
+
+static void
+text_buf_put(char * buf)
+{
+    text_buf = buf;
+}
+
+/*
+ * File names are kept for as long as the scores and the duplicate table
+ * refer to them, so they are copied into large chunks rather than
+ * allocated one at a time.  Watching frees names along with their
+ * records, so then each name gets an allocation of its own.
+ */
+#define NAME_CHUNK_SIZE (64 * 1024)
+
+static char *  name_chunk = NULL;
+static size_t  name_room  = 0;
+
+static char const *
+keep_name(char const * name)
+{
+    size_t len = strlen(name) + 1;
+    char * res;
+
+    if (HAVE_OPT(WATCH) || (len > NAME_CHUNK_SIZE / 8)) {
+        mem_account(MEM_NAMES, len);
+        res = malloc(len);
+        if (res == NULL)
+            die(COMPLEXITY_EXIT_NOMEM, nomem_fmt, (int)len);
+        return memcpy(res, name, len);
     }
 
-    {
-        size_t bfsz = cmdlen + strlen(fname);
-        char * bf   = malloc(bfsz);
-        FILE * res;
-        if (bf == NULL)
-            die(COMPLEXITY_EXIT_NOMEM, nomem_fmt, bfsz);
-        size_t sz = snprintf(bf, bfsz, "%s %s", cmd, fname);
-        CX_ASSERT(sz < bfsz);
-
-        res  = popen(bf, "r");
-        free(bf);
-        return res;
+    if (len > name_room) {
+        mem_account(MEM_NAMES, NAME_CHUNK_SIZE);
+        name_chunk = malloc(NAME_CHUNK_SIZE);
+        if (name_chunk == NULL)
+            die(COMPLEXITY_EXIT_NOMEM, nomem_fmt, NAME_CHUNK_SIZE);
+        name_room = NAME_CHUNK_SIZE;
+    }
+
+    res = memcpy(name_chunk, name, len);
+    name_chunk += len;
+    name_room  -= len;
+    return res;
+}
+
+/**
+ * Release a name from keep_name() that nothing refers to.  A chunked
+ * name can only be taken back if it was the last one handed out.
+ */
+static void
+drop_name(char const * name)
+{
+    size_t len = strlen(name) + 1;
+
+    if (HAVE_OPT(WATCH) || (len > NAME_CHUNK_SIZE / 8)) {
+        free((void *)name);
+        mem_account(MEM_NAMES, -(long)len);
+
+    } else if (name + len == name_chunk) {
+        name_chunk -= len;
+        name_room  += len;
+    }
+}
+
+/**
+ * Read until "len" bytes are in or the input ends.
+ */
+static size_t
+read_fully(int fd, char * buf, size_t len)
+{
+    size_t done = 0;
+
+    while (done < len) {
+        ssize_t ct = read(fd, buf + done, len - done);
+        if (ct <= 0) {
+            if ((ct < 0) && (errno == EINTR))
+                continue;
+            break;
+        }
+        done += ct;
     }
+
+    return done;
 }
 
 static bool
 load_file(fstate_t * fs)
 {
     unsigned long const pgsz = sysconf(_SC_PAGE_SIZE);
-    off_t fsiz = pgsz * 4;
-    off_t foff = 0;
-    bool  is_guess = true;
+    size_t fsiz = pgsz * 4;
+    size_t foff = 0;
+    bool   is_guess = true;
     char * full_text;
-    char * rdp;
 
     {
         struct stat sb;
-        if (fstat(fileno(fs->fs_fp), &sb) >= 0) {
+        if (fstat(fs->fs_fd, &sb) >= 0) {
             if (S_ISREG(sb.st_mode)) {
                 fsiz = sb.st_size + 1;
                 is_guess = false;
@@ -362,42 +1019,27 @@ load_file(fstate_t * fs)
         }
     }
 
-    rdp = full_text = malloc(fsiz);
-    if (full_text == NULL)
-        die(COMPLEXITY_EXIT_NOMEM, nomem_fmt, fsiz);
+    full_text = text_buf_get(fsiz, &fsiz);
 
     for (;;) {
-        size_t ct   = fsiz - foff;
-        size_t rdct = fread(rdp, 1, ct, fs->fs_fp);
+        size_t ct   = fsiz - 1 - foff;
+        size_t rdct = read_fully(fs->fs_fd, full_text + foff, ct);
 
-        if ((rdct < ct) || (! is_guess)) {
-            rdp[rdct] = '\0';
+        foff += rdct;
+        if ((rdct < ct) || (! is_guess))
             break;
-        }
 
         /*
          *  We've filled out buffer and we don't know final size.
          *
          *  4, 6, 9, 13, 19, 28, ... pages
          */
-        fsiz += (fsiz / 2) & ~(pgsz - 1);
-        full_text = realloc(full_text, fsiz);
-        if (full_text == NULL)
-            die(COMPLEXITY_EXIT_NOMEM,
-                "reallocation of %d to %d bytes failed\n",
-                (fsiz * 2) / 3, fsiz);
-
-        foff += rdct;
-        rdp  = full_text + foff;
+        full_text = text_buf_grow(full_text, &fsiz,
+                                  fsiz + ((fsiz / 2) & ~(pgsz - 1)));
     }
 
-    fs->fs_text  = fs->fs_scan = full_text;
-    fs->cur_line = 1;
-    fs->nc_line  = 0;
-    fs->fs_bol   = true;
-    fs->last_tkn = TKN_EOF;
-    if (HAVE_OPT(TRACE))
-        fprintf(trace_fp, "\nLoading file %s\n", fs->fs_fname);
+    full_text[foff] = NUL;
+    set_text(fs, full_text);
     return true;
 }
 
@@ -412,6 +1054,7 @@ add_score(state_t * pstate)
     if (val >= MAX_SCORE) {
         fprintf(stderr, "unscored: %s in %s on line %d\n",
                 pstate->pname, pstate->st_fstate->fs_fname, pstate->proc_line);
+        pstate->st_fstate->fs_diag_ct++;
         unscore_ct++;
         return false;
     }
@@ -425,165 +1068,1080 @@ add_score(state_t * pstate)
     return true;
 }
 
-static void
-re_die(int code, regex_t * re, char const * pat)
-{
-    char msg[64];
-    (void)regerror(code, re, msg, sizeof(msg));
-    die(COMPLEXITY_EXIT_ASSERT, "re error %s (%u) compiling ''%s''\n",
-        msg, (unsigned)code, pat);
-}
-
-static regex_t *
-re_compile(void)
+/**
+ * Find the end of the procedure that starts at the scan point:  just past
+ * the first close brace that starts a line.  Only the procedure's own
+ * text is looked at, so the cost of finding every end in a file stays
+ * proportional to the file size.
+ */
+static char *
+find_proc_end(fstate_t * fs)
 {
-    static char const pat[] = "[\r\n]\\}";
-
-    regex_t * res = malloc(sizeof(*res));
-    if (res == NULL)
-        die(COMPLEXITY_EXIT_NOMEM, nomem_fmt, (int)sizeof(*res));
-
-    {
-        int reres = regcomp(res, pat, REG_EXTENDED);
-        if (reres != 0)
-            re_die(reres, res, pat);
-    }
-
-    return res;
-}
+    char * scan = BRK_END_OF_LINE_CHARS(fs->fs_scan);
+    char * close_brace = strchr(fs->fs_scan, '}');
 
-static bool
-find_proc_end(state_t * ps, regex_t * re)
-{
-    regmatch_t match;
-    char * scan = BRK_END_OF_LINE_CHARS(ps->st_fstate->fs_scan);
+    if (close_brace == NULL)
+        return NULL;
 
     /*
      * special case a one-line function (where opening and closing
      * braces are on the same line).
      */
-    {
-        char * close_brace = strchr(ps->st_fstate->fs_scan, '}');
-        if (close_brace == NULL)
-            return false;
-
-        if (close_brace < scan) {
-            ps->st_end = close_brace + 1; // same line
-            return true;
-        }
-    }
+    if (close_brace < scan)
+        return close_brace + 1; // same line
 
     /*
-     * run the regex looking for a CR or LF preceding a '}'
+     * look for a CR or LF preceding a '}'
      */
-    if (regexec(re, scan, 1, &match, 0) != 0)
-        return false;
-    ps->st_end = scan + match.rm_eo;
-    return true;
+    for (; close_brace != NULL; close_brace = strchr(close_brace + 1, '}'))
+        if (IS_END_OF_LINE_CHAR(close_brace[-1]))
+            return close_brace + 1;
+    return NULL;
+}
+
+/**
+ * Advance the scan pointer past a procedure we are not scoring,
+ * keeping the line count current.
+ */
+static void
+skip_proc_body(fstate_t * fs, char const * end)
+{
+    while (fs->fs_scan < end) {
+        if (fs->fs_scan[0] == NL)
+            fs->cur_line++;
+        fs->fs_scan++;
+    }
+}
+
+/**
+ * Add a scored procedure to the totals and the list of scores.
+ * With --summary-only, it is only counted and the caller still owns
+ * the record.
+ */
+static void
+keep_score(state_t * pstate)
+{
+    if (pstate->st_nc_line_ct != 0) {
+        score_ttl   += (pstate->score * pstate->st_nc_line_ct);
+        ttl_line_ct += pstate->st_nc_line_ct;
+    }
+
+    if (HAVE_OPT(SUMMARY_ONLY)) {
+        score_ct++;
+        hist_update(pstate, 1);
+        return;
+    }
+
+    if (++score_ct >= score_alloc_ct) {
+        mem_account(MEM_SCORES, (score_alloc_ct / 2) * sizeof(*scores));
+        score_alloc_ct += score_alloc_ct / 2;
+        size_t sz = score_alloc_ct * sizeof(*scores);
+        scores = realloc(scores, sz);
+        if (scores == NULL)
+            die(COMPLEXITY_EXIT_NOMEM, nomem_fmt, sz);
+    }
+
+    scores[score_ct-1] = pstate;
+    hist_update(pstate, 1);
+    if (HAVE_OPT(ROLLUP))
+        rollup_add(pstate);
+}
+
+/**
+ * Return the procedures scored since "score_ct" was "first".
+ */
+state_t * const *
+scores_since(int first)
+{
+    return scores + first;
+}
+
+int
+unscored_count(void)
+{
+    return unscore_ct;
+}
+
+int
+folded_count(void)
+{
+    return fold_ct;
+}
+
+/**
+ * Keep a score read back from a partial result file.  The current
+ * threshold still applies.
+ */
+void
+merge_score(state_t * pstate)
+{
+    int val = (int)(pstate->score);
+
+    if (threshold > pstate->score) {
+        free(pstate);
+        mem_account(MEM_STATE, -(long)sizeof(*pstate));
+        return;
+    }
+
+    if (val > high_score) {
+        snprintf(high_buf, sizeof(high_buf), "%s() in %s",
+                 pstate->pname, pstate->st_end);
+        high_score = val;
+    }
+    keep_score(pstate);
+
+    if (HAVE_OPT(SUMMARY_ONLY)) {
+        free(pstate);
+        mem_account(MEM_STATE, -(long)sizeof(*pstate));
+    }
+}
+
+void
+merge_counts(int unscored, int folded)
+{
+    unscore_ct += unscored;
+    fold_ct    += folded;
 }
 
+/**
+ * Withdraw previously kept scores, e.g. for a file that has changed.
+ * The records are removed from the totals and from the list of scores,
+ * but are not freed.
+ */
+void
+forget_scores(state_t * const * recs, int ct, int unscored)
+{
+    bool lost_high = false;
+    int  ix;
+    int  keep;
+
+    unscore_ct -= unscored;
+    if (ct == 0)
+        return;
+
+    for (ix = 0; ix < ct; ix++) {
+        state_t * pstate = recs[ix];
+
+        if (pstate->st_nc_line_ct != 0) {
+            score_ttl   -= (pstate->score * pstate->st_nc_line_ct);
+            ttl_line_ct -= pstate->st_nc_line_ct;
+        }
+        hist_update(pstate, -1);
+        if ((int)pstate->score >= high_score)
+            lost_high = true;
+        pstate->st_end = NULL; // marks it for removal below
+    }
+
+    for (ix = keep = 0; ix < score_ct; ix++)
+        if (scores[ix]->st_end != NULL)
+            scores[keep++] = scores[ix];
+    score_ct = keep;
+
+    if (! lost_high)
+        return;
+
+    high_score = 0;
+    high_buf[0] = NUL;
+    for (ix = 0; ix < score_ct; ix++) {
+        int val = (int)scores[ix]->score;
+        if (val > high_score) {
+            snprintf(high_buf, sizeof(high_buf), "%s() in %s",
+                     scores[ix]->pname, scores[ix]->st_end);
+            high_score = val;
+        }
+    }
+}
+
+/*
+ * A state record not kept by the last procedure, for the next one.
+ */
+static state_t * spare_state = NULL;
+
 static bool
 do_proc(fstate_t * fs)
 {
     bool res = true;
-    static regex_t * re = NULL;
-    state_t * pstate = malloc(sizeof(*pstate));
-    if (pstate == NULL)
-        die(COMPLEXITY_EXIT_NOMEM, nomem_fmt, (int)sizeof(*pstate));
+    state_t * pstate;
+
+    /*
+     * Ignored procedures never get a state record.  Just hop over them.
+     */
+    if (HAVE_OPT(IGNORE) && is_ignored(fs->tkn_text, fs->tkn_len)) {
+        char const * end = find_proc_end(fs);
+        run_metrics.mt_ignored++;
+        if (end != NULL)
+            skip_proc_body(fs, end);
+        return res;
+    }
+
+    if (budget_file_spent()) {
+        fprintf(stderr, "budget: stopped scoring %s on line %d\n",
+                fs->fs_fname, fs->cur_line);
+        fs->fs_diag_ct++;
+        return false;
+    }
 
-    if (re == NULL)
-        re = re_compile();
+    pstate = spare_state;
+    spare_state = NULL;
+    if (pstate == NULL) {
+        mem_account(MEM_STATE, sizeof(*pstate));
+        pstate = malloc(sizeof(*pstate));
+        if (pstate == NULL)
+            die(COMPLEXITY_EXIT_NOMEM, nomem_fmt, (int)sizeof(*pstate));
+    }
 
     state_init(pstate, fs);
 
-    if (! find_proc_end(pstate, re))
+    pstate->st_end = find_proc_end(fs);
+    if (pstate->st_end == NULL)
         goto all_done;
 
-    if (HAVE_OPT(IGNORE)) {
-        int ct = STACKCT_OPT(IGNORE);
-        char const ** il = STACKLST_OPT(IGNORE);
+    pstate->proc_line = fs->cur_line;
 
-        do  {
-            if (strcmp(*(il++), pstate->pname) == 0)
-                goto skip_proc;
-        } while (--ct > 0);
+    if (memo_find(pstate))
+        run_metrics.mt_reused++;
+    else {
+        score_proc(pstate);
+        memo_add(pstate);
+    }
+    run_metrics.mt_scored++;
+    if (! add_score(pstate)) {
+        skip_proc_body(fs, pstate->st_end);
+        goto all_done;
     }
 
-    pstate->proc_line = fs->cur_line;
+    if (pstate->st_nc_line_ct == 0)
+        pstate->score = 0;
 
-    score_proc(pstate);
-    if (! add_score(pstate))
-        goto skip_proc;
+    pstate->st_end = (char *)fs->fs_fname;
+    pstate->st_file_ix = file_ord;
+    keep_score(pstate);
+    if (HAVE_OPT(FAIL_FAST) && ((int)pstate->score > OPT_VALUE_HORRID_THRESHOLD))
+        fail_fast(pstate);
+    if (HAVE_OPT(SUMMARY_ONLY))
+        goto all_done;
+    return res;
 
-    if (pstate->st_nc_line_ct == 0) {
-        pstate->score = 0;
-    } else {
-        score_ttl   += (pstate->score * pstate->st_nc_line_ct);
-        ttl_line_ct += pstate->st_nc_line_ct;
+ all_done:
+
+    spare_state = pstate;
+    return res;
+}
+
+/**
+ * Remember where each file's scores went so that a later file with the
+ * same contents (and the same unifdef arguments), or a link to the same
+ * inode, can reuse them.
+ */
+static inline uint64_t
+hash_text(char const * text, size_t * len, uint64_t res)
+{
+    char const * p = text;
+
+    for (; *p != NUL; p++)
+        res = (res ^ (unsigned char)*p) * 0x100000001B3ULL;
+    *len = p - text;
+    return res;
+}
+
+static uint64_t
+hash_args(int ct, char const * const * args)
+{
+    uint64_t res = 0xCBF29CE484222325ULL;
+    size_t   len;
+
+    while (ct-- > 0)
+        res = hash_text(*(args++), &len, res ^ NL);
+    return res;
+}
+
+/**
+ * Look for copies, unless --summary-only leaves none to replay or fold.
+ */
+static inline bool
+dup_checking(void)
+{
+    return ! HAVE_OPT(SUMMARY_ONLY) || HAVE_OPT(FOLD_DUPLICATES);
+}
+
+/**
+ * Check for a file we have already seen through another link.
+ */
+static dup_ent_t *
+dup_find_inode(struct stat const * sb, uint64_t fl_hash)
+{
+    if ((dup_mask == 0) || HAVE_OPT(WATCH))
+        return NULL;
+
+    size_t ix = (size_t)(sb->st_ino ^ sb->st_dev ^ fl_hash) & dup_mask;
+
+    for (; dup_by_ino[ix] >= 0; ix = (ix + 1) & dup_mask) {
+        dup_ent_t * de = dups + dup_by_ino[ix];
+        if (  (de->de_ino == sb->st_ino) && (de->de_dev == sb->st_dev)
+           && (de->de_fl_hash == fl_hash))
+            return de;
     }
+    return NULL;
+}
 
-    if (++score_ct >= score_alloc_ct) {
-        score_alloc_ct += score_alloc_ct / 2;
-        size_t sz = score_alloc_ct * sizeof(*scores);
-        scores = realloc(scores, sz);
-        if (scores == NULL)
-            die(COMPLEXITY_EXIT_NOMEM, nomem_fmt, sz);
+/**
+ * Find an earlier file with the same text.  The text is long gone, so
+ * a match of the hash and length is taken as a match of the text.
+ */
+static dup_ent_t *
+dup_find_text(uint64_t hash, size_t len, uint64_t fl_hash)
+{
+    if ((dup_mask == 0) || HAVE_OPT(WATCH))
+        return NULL;
+
+    for (size_t ix = (size_t)hash & dup_mask; dup_by_text[ix] >= 0;
+         ix = (ix + 1) & dup_mask) {
+        dup_ent_t * de = dups + dup_by_text[ix];
+        if (  (de->de_hash == hash) && (de->de_len == len)
+           && (de->de_fl_hash == fl_hash))
+            return de;
     }
+    return NULL;
+}
 
-    pstate->st_end     = (char *)fs->fs_fname;
-    scores[score_ct-1] = pstate;
-    return res;
+static void
+dup_index(int dx)
+{
+    dup_ent_t * de = dups + dx;
+    size_t ix = (size_t)de->de_hash & dup_mask;
 
- skip_proc:
+    while (dup_by_text[ix] >= 0)
+        ix = (ix + 1) & dup_mask;
+    dup_by_text[ix] = dx;
 
-    while (fs->fs_scan < pstate->st_end) {
-        if (fs->fs_scan[0] == NL)
-            fs->cur_line++;
-        fs->fs_scan++;
+    if (! de->de_has_ino)
+        return;
+
+    ix = (size_t)(de->de_ino ^ de->de_dev ^ de->de_fl_hash) & dup_mask;
+    while (dup_by_ino[ix] >= 0)
+        ix = (ix + 1) & dup_mask;
+    dup_by_ino[ix] = dx;
+}
+
+static void
+dup_record(dup_ent_t const * de)
+{
+    if ((size_t)dup_ct * 2 >= dup_mask) {
+        size_t sz = (dup_mask == 0) ? 64 : (dup_mask + 1) * 2;
+        size_t bytes = sz * 2 * sizeof(int);
+
+        dup_mask    = sz - 1;
+        dup_by_text = realloc(dup_by_text, bytes);
+        if (dup_by_text == NULL)
+            die(COMPLEXITY_EXIT_NOMEM, nomem_fmt, (int)bytes);
+        dup_by_ino  = dup_by_text + sz;
+        memset(dup_by_text, 0xFF, bytes);
+
+        bytes = sz / 2 * sizeof(*dups);
+        dups  = realloc(dups, bytes);
+        if (dups == NULL)
+            die(COMPLEXITY_EXIT_NOMEM, nomem_fmt, (int)bytes);
+
+        for (int ix = 0; ix < dup_ct; ix++)
+            dup_index(ix);
     }
 
- all_done:
+    dups[dup_ct] = *de;
+    dup_index(dup_ct++);
+}
 
-    free(pstate);
-    return res;
+/**
+ * Report the procedures of an earlier copy of this file again, under
+ * this file's name -- or not at all with --fold-duplicates.
+ */
+static complexity_exit_code_t
+dup_replay(dup_ent_t const * de, char const * fname)
+{
+    if (HAVE_OPT(TRACE))
+        fprintf(trace_fp, "\n%s duplicates %s\n", fname, de->de_fname);
+
+    if (HAVE_OPT(FOLD_DUPLICATES)) {
+        fold_ct++;
+        return COMPLEXITY_EXIT_SUCCESS;
+    }
+
+    if (de->de_end > de->de_first) {
+        char const * nm = keep_name(fname);
+
+        for (int ix = de->de_first; ix < de->de_end; ix++) {
+            mem_account(MEM_STATE, sizeof(state_t));
+            state_t * pstate = malloc(sizeof(*pstate));
+            if (pstate == NULL)
+                die(COMPLEXITY_EXIT_NOMEM, nomem_fmt, (int)sizeof(*pstate));
+            *pstate = *scores[ix];
+            pstate->st_end = (char *)nm;
+            pstate->st_file_ix = file_ord;
+            keep_score(pstate);
+        }
+    }
+    return COMPLEXITY_EXIT_SUCCESS;
+}
+
+static int
+count_lines(char const * from, char const * to)
+{
+    int ct = 0;
+
+    while ((from = memchr(from, NL, to - from)) != NULL) {
+        ct++;
+        from++;
+    }
+    return ct;
+}
+
+/**
+ * Start the tokenizer afresh at "at", which is on line "line".
+ */
+static void
+target_seek(fstate_t * fs, char const * at, int line)
+{
+    fs->fs_scan  = at;
+    fs->cur_line = line;
+    fs->fs_bol   = (at == fs->fs_text) || (at[-1] == NL);
+    fs->last_tkn = TKN_EOF;
+}
+
+/*
+ * Where a scan of the raw text has got to.  It follows the tokenizer
+ * over comments, strings and preprocessing directives, so that a close
+ * brace or a procedure name inside one of them is not taken for code.
+ * The streaming window is cut with it (see stream_cut()), and
+ * --function uses it to pass over names that are not code.
+ */
+typedef enum {
+    SL_CODE, SL_COMMENT, SL_LINE_CMT, SL_DQUOT, SL_SQUOT, SL_DIRECTIVE
+} stream_lex_state_t;
+
+typedef struct {
+    size_t              sl_off;     //!< next byte to look at
+    size_t              sl_cut;     //!< just past the last cut, or 0
+    stream_lex_state_t  sl_state;
+    bool                sl_bol;     //!< only white space on the line
+    bool                sl_brace;   //!< the line starts with a '}'
+} stream_lex_t;
+
+/**
+ * Move the scan of "text" over the character at "scan".  Returns where
+ * the next character is, which is past both characters of a comment
+ * marker or an escape.  A newline ending a line that starts with a
+ * closing brace in code is noted in "sl_cut".
+ */
+static char const *
+lex_char(stream_lex_t * sl, char const * text, char const * scan)
+{
+    char ch = *(scan++);
+
+    if (ch == NL) {
+        switch (sl->sl_state) {
+        case SL_LINE_CMT:
+        case SL_DIRECTIVE:
+            sl->sl_state = SL_CODE;
+            /* FALLTHROUGH */
+
+        case SL_CODE:
+            if (sl->sl_brace)
+                sl->sl_cut = scan - text;
+            break;
+
+        default: ;
+        }
+        sl->sl_bol   = true;
+        sl->sl_brace = false;
+        return scan;
+    }
+
+    switch (sl->sl_state) {
+    case SL_CODE:
+        switch (ch) {
+        case ' ': case '\t': case CR: case '\f': case '\v':
+            return scan;
+
+        case '}':
+            if ((scan - 1 == text) || (scan[-2] == NL))
+                sl->sl_brace = true;
+            break;
+
+        case '#':
+            if (sl->sl_bol)
+                sl->sl_state = SL_DIRECTIVE;
+            break;
+
+        case FSLASH:
+            if (*scan == '*')
+                sl->sl_state = SL_COMMENT, scan++;
+            else if (*scan == FSLASH)
+                sl->sl_state = SL_LINE_CMT, scan++;
+            break;
+
+        case DQUOT:
+            sl->sl_state = SL_DQUOT;
+            break;
+
+        case SQUOT:
+            sl->sl_state = SL_SQUOT;
+            break;
+        }
+        sl->sl_bol = false;
+        break;
+
+    case SL_COMMENT:
+        if ((ch == '*') && (*scan == FSLASH))
+            sl->sl_state = SL_CODE, scan++;
+        break;
+
+    case SL_DQUOT:
+    case SL_SQUOT:
+        if (ch == BSLASH)
+            scan++;
+        else if (ch == ((sl->sl_state == SL_DQUOT) ? DQUOT : SQUOT))
+            sl->sl_state = SL_CODE;
+        break;
+
+    case SL_DIRECTIVE:
+        if ((ch == BSLASH) && (*scan == NL))
+            scan++;
+        break;
+
+    case SL_LINE_CMT:
+        break;
+    }
+    return scan;
+}
+
+/**
+ * Score the procedures named by --function.  The text is searched for
+ * the name followed by an opening parenthesis.  Places inside comments,
+ * strings and directives are passed over, and the others are checked
+ * for a procedure definition before they are scored.  Line numbers are
+ * counted from one place found to the next.
+ */
+static void
+score_named(fstate_t * fs)
+{
+    char const * name = OPT_ARG(FUNCTION);
+    size_t       len  = strlen(name);
+    char const * end  = fs->fs_scan + strlen(fs->fs_scan);
+    char const * scan = fs->fs_scan;
+    char const * mark = fs->fs_scan;
+    char const * lex  = fs->fs_scan;    //!< how far "sl" has got
+    int          line = fs->cur_line;
+    stream_lex_t sl   = { .sl_state = SL_CODE, .sl_bol = fs->fs_bol };
+
+    for (;;) {
+        char const * hit = memmem(scan, end - scan, name, len);
+        char const * p;
+
+        if (hit == NULL)
+            return;
+        scan = hit + len;
+
+        while (lex < hit)
+            lex = lex_char(&sl, fs->fs_text, lex);
+        if ((lex != hit) || (sl.sl_state != SL_CODE))
+            continue;
+
+        if ((hit > fs->fs_text) && IS_NAME_CHAR(hit[-1]))
+            continue;
+        for (p = scan; IS_SPACE_CHAR(*p); p++)  ;
+        if (*p != '(')
+            continue;
+
+        line += count_lines(mark, hit);
+        mark  = hit;
+        target_seek(fs, hit, line);
+        if (! check_proc_start(fs))
+            continue;
+
+        fs->cur_line = line + count_lines(hit, fs->fs_scan);
+        if (! do_proc(fs))
+            return;
+        if (scan < fs->fs_scan) {
+            scan = lex = fs->fs_scan;
+            sl   = (stream_lex_t) { .sl_state = SL_CODE };
+        }
+    }
+}
+
+/**
+ * Score the procedure that contains the --at line, from the line with
+ * its name through its closing brace.  Procedures normally end with a
+ * closing brace at the start of a line (see find_proc_end()), so the
+ * search starts on the line after the last such brace.  Each
+ * procedure found from there is tokenized to its matching brace, as
+ * the scoring would, to see whether it reaches the line.
+ */
+static void
+score_at_line(fstate_t * fs)
+{
+    char const * text = fs->fs_text;
+    char const * line = text;
+    char const * from;
+    int          from_line;
+
+    for (int ln = 1; ln < at_line; ln++) {
+        line = strchr(line, NL);
+        if (line == NULL)
+            return;
+        line++;
+    }
+
+    for (from = line;;) {
+        char const * brace = memrchr(text, '}', from - text);
+        if (brace == NULL) {
+            from = text;
+            break;
+        }
+
+        /*
+         * A brace starting a continued macro line does not count.
+         */
+        if ((brace > text) && IS_END_OF_LINE_CHAR(brace[-1])) {
+            char const * eol = brace - 1;
+            if ((eol > text) && (*eol == NL) && (eol[-1] == CR))
+                eol--;
+            if ((eol > text) && (eol[-1] == '\\')) {
+                from = brace;
+                continue;
+            }
+        }
+
+        if ((brace == text) || IS_END_OF_LINE_CHAR(brace[-1])) {
+            from = (char const *)memchr(brace, NL, line - brace) + 1;
+            break;
+        }
+        from = brace;
+    }
+
+    from_line = at_line - count_lines(from, line);
+    target_seek(fs, from, from_line);
+
+    while (find_proc_start(fs)) {
+        fstate_t start = *fs;
+        int      first = from_line + count_lines(from, fs->tkn_text);
+        int      depth = 1;
+
+        if (first > at_line)
+            return;
+
+        from      = fs->fs_scan;
+        from_line = first + count_lines(fs->tkn_text, from);
+        start.cur_line = from_line;
+
+        while (depth > 0) {
+            switch (next_token(fs)) {
+            case TKN_LIT_OBRACE: depth++; break;
+            case TKN_LIT_CBRACE: depth--; break;
+            case TKN_EOF:        depth = 0; break;
+            default:             break;
+            }
+        }
+
+        from_line += count_lines(from, fs->fs_scan);
+        from = fs->fs_scan;
+        if (at_line <= from_line) {
+            *fs = start;
+            do_proc(fs);
+            return;
+        }
+        fs->cur_line = from_line;
+    }
+}
+
+/**
+ * Score only the procedures asked for with --function or --at.
+ * Duplicate files are not looked for, since only part of the text is
+ * looked at.
+ */
+static complexity_exit_code_t
+score_target(fstate_t * fs)
+{
+    int            first = score_ct;
+    metric_phase_t phase = metrics_phase(MP_SCORE);
+
+    run_metrics.mt_files++;
+    fs->fs_fname = keep_name(fs->fs_fname);
+    budget_file_start();
+
+    if (HAVE_OPT(AT))
+        score_at_line(fs);
+    else
+        score_named(fs);
+
+    if ((score_ct == first) && ! HAVE_OPT(DUP_FUNCTIONS))
+        drop_name(fs->fs_fname);
+
+    fflush(stdout);
+    metrics_phase(phase);
+    metrics_tick();
+
+    if (high_score > OPT_VALUE_HORRID_THRESHOLD)
+        return COMPLEXITY_EXIT_HORRID_FUNCTION;
+    return COMPLEXITY_EXIT_SUCCESS;
+}
+
+/**
+ * Score all the procedures in the text loaded into "fs", unless the same
+ * text has been scored already.  The file name is copied because the
+ * scores refer to it.
+ */
+static complexity_exit_code_t
+score_text(fstate_t * fs, uint64_t fl_hash, struct stat const * sb)
+{
+    dup_ent_t de = {
+        .de_fl_hash  = fl_hash,
+        .de_first    = score_ct
+    };
+    dup_ent_t * prev;
+    metric_phase_t phase;
+
+    if (HAVE_OPT(FUNCTION) || HAVE_OPT(AT))
+        return score_target(fs);
+
+    phase = metrics_phase(MP_SCORE);
+    de.de_hash = hash_text(fs->fs_text, &de.de_len,
+                           0xCBF29CE484222325ULL ^ fl_hash);
+    prev = dup_checking()
+        ? dup_find_text(de.de_hash, de.de_len, fl_hash) : NULL;
+    run_metrics.mt_files++;
+    run_metrics.mt_bytes += de.de_len;
+
+    if (prev != NULL)
+        dup_replay(prev, fs->fs_fname);
+
+    else {
+        if (dup_checking())
+            fs->fs_fname = keep_name(fs->fs_fname);
+
+        budget_file_start();
+        while (find_proc_start(fs))
+            if (! do_proc(fs))
+                break;
+
+        de.de_end      = score_ct;
+        de.de_fname    = fs->fs_fname;
+        if (sb != NULL) {
+            de.de_has_ino = true;
+            de.de_dev     = sb->st_dev;
+            de.de_ino     = sb->st_ino;
+        }
+        /*
+         * In watch mode, scores come and go.  Do not remember them.
+         * A copy of text that drew diagnostics is scored again, so
+         * that they are printed under its name, too.
+         */
+        if (dup_checking() && ! HAVE_OPT(WATCH) && (fs->fs_diag_ct == 0))
+            dup_record(&de);
+
+        /*
+         * When watching, the copied name is freed with the records.
+         * With no records, nothing else refers to it.
+         */
+        if (HAVE_OPT(WATCH) && (score_ct == de.de_first))
+            drop_name(fs->fs_fname);
+    }
+
+    fflush(stdout);
+    metrics_phase(phase);
+    metrics_tick();
+
+    if (high_score > OPT_VALUE_HORRID_THRESHOLD)
+        return COMPLEXITY_EXIT_HORRID_FUNCTION;
+    return COMPLEXITY_EXIT_SUCCESS;
+}
+
+/**
+ * Check for a link to a file that was already scored.  On success,
+ * "sb" is filled in for recording this file.
+ */
+static bool
+dup_link(char const * fname, uint64_t fl_hash, struct stat * sb,
+         complexity_exit_code_t * res)
+{
+    dup_ent_t * prev;
+
+    if (! dup_checking())
+        return false;
+
+    if ((stat(fname, sb) != 0) || ! S_ISREG(sb->st_mode))
+        return false;
+
+    prev = dup_find_inode(sb, fl_hash);
+    if (prev == NULL)
+        return false;
+
+    dup_replay(prev, fname);
+    run_metrics.mt_files++;
+    *res = (high_score > OPT_VALUE_HORRID_THRESHOLD)
+        ? COMPLEXITY_EXIT_HORRID_FUNCTION : COMPLEXITY_EXIT_SUCCESS;
+    return true;
 }
 
+/**
+ * Score source text that is already in memory (e.g. an archive member).
+ * "text" must be NUL terminated and is not retained.
+ */
 complexity_exit_code_t
-complex_eval(char const * fname)
+complex_eval_text(char const * fname, char const * text)
+{
+    fstate_t fstate = { .fs_fname = fname };
+
+    file_ord++;
+    if (! in_shard(fname) || ! sample_file(fname, file_ord))
+        return COMPLEXITY_EXIT_SUCCESS;
+
+    mem_set_file(fname);
+    set_text(&fstate, text);
+    return score_text(&fstate, 0, NULL);
+}
+
+/**
+ * Find where the next streaming window should end: just past the last
+ * complete line that starts with a closing brace and ends outside of
+ * any comment, string or directive.  That is where find_proc_end() says
+ * a procedure ends, so the window never splits one.  Only complete
+ * lines are scanned, and the scan picks up where it stopped the last
+ * time.  Returns NULL if there is no such line.
+ */
+static char *
+stream_cut(stream_lex_t * sl, char * text, size_t fill)
+{
+    char *       end  = text + fill;
+    char const * scan = text + sl->sl_off;
+
+    while ((end > scan) && (end[-1] != NL))
+        end--;
+
+    while (scan < end)
+        scan = lex_char(sl, text, scan);
+
+    sl->sl_off = scan - text;
+    return (sl->sl_cut == 0) ? NULL : text + sl->sl_cut;
+}
+
+/**
+ * Score a file through a window that holds only as much text as the
+ * current procedure needs.  The window is cut after a line starting
+ * with a closing brace (see stream_cut()) and the scanning state is
+ * carried from one window to the next.  Streamed text is not checked
+ * for duplicates, since it is never all in memory at once.
+ */
+static complexity_exit_code_t
+eval_stream(char const * fname)
+{
+    size_t  buf_sz;
+    char *  buf;
+    char *  text;
+    size_t  fill     = 0;
+    bool    at_eof   = false;
+    int     first    = score_ct;
+    fstate_t fstate  = { .fs_fd = open(fname, O_RDONLY) };
+    stream_lex_t lex = { .sl_state = SL_CODE, .sl_bol = true };
+
+    if (fstate.fs_fd < 0)
+        return COMPLEXITY_EXIT_BAD_FILE;
+
+    buf  = text_buf_get(STREAM_BLOCK_SIZE * 2 + 1, &buf_sz);
+    buf_sz--;
+    text = buf + 1; // leave room for a newline before the text
+    fstate.fs_fname = keep_name(fname);
+
+    buf[0] = NL;
+    set_text(&fstate, "");
+    run_metrics.mt_files++;
+    budget_file_start();
+
+    while (! at_eof || (fill > 0)) {
+        char * cut = NULL;
+        char   save;
+
+        metric_phase_t phase = metrics_phase(MP_READ);
+        while (! at_eof) {
+            size_t room = buf_sz - 1 - fill;
+
+            if (room < STREAM_BLOCK_SIZE) {
+                /*
+                 * The current procedure is bigger than the window.
+                 */
+                buf_sz++;
+                buf  = text_buf_grow(buf, &buf_sz, buf_sz + buf_sz / 2);
+                buf_sz--;
+                text = buf + 1;
+                room = buf_sz - 1 - fill;
+            }
+
+            size_t rdct = read_fully(fstate.fs_fd, text + fill, room);
+            fill += rdct;
+            run_metrics.mt_bytes += rdct;
+            at_eof = (rdct < room);
+
+            cut = stream_cut(&lex, text, fill);
+            if (cut != NULL)
+                break;
+        }
+        metrics_phase(phase);
+
+        if (at_eof)
+            cut = text + fill;
+
+        save   = *cut;
+        *cut   = NUL;
+        fstate.fs_text  = fstate.fs_scan = text;
+        fstate.last_tkn = TKN_EOF;
+
+        phase = metrics_phase(MP_SCORE);
+        while (find_proc_start(&fstate))
+            if (! do_proc(&fstate))
+                break;
+        metrics_phase(phase);
+
+        if (budget_file_spent())
+            break;
+
+        /*
+         * The cut is the last one found, and the scan state still
+         * applies to the text after it.
+         */
+        *cut = save;
+        lex.sl_off -= cut - text;
+        lex.sl_cut  = 0;
+        fill = text + fill - cut;
+        memmove(text, cut, fill);
+    }
+
+    close(fstate.fs_fd);
+    text_buf_put(buf);
+
+    /*
+     * The kept scores, and any --dup-functions listing, refer to the
+     * copied name.
+     */
+    if (  ((score_ct == first) || HAVE_OPT(SUMMARY_ONLY))
+       && ! HAVE_OPT(DUP_FUNCTIONS))
+        drop_name(fstate.fs_fname);
+
+    fflush(stdout);
+    metrics_tick();
+
+    if (high_score > OPT_VALUE_HORRID_THRESHOLD)
+        return COMPLEXITY_EXIT_HORRID_FUNCTION;
+    return COMPLEXITY_EXIT_SUCCESS;
+}
+
+/**
+ * Load and score a source file.
+ */
+static complexity_exit_code_t
+eval_file(char const * fname)
 {
-    complexity_exit_code_t res = COMPLEXITY_EXIT_SUCCESS;
+    complexity_exit_code_t res;
+    struct stat sb = { .st_mode = 0 };
+
+    if (HAVE_OPT(STREAM))
+        return eval_stream(fname);
+
+    if (dup_link(fname, 0, &sb, &res))
+        return res;
 
     fstate_t fstate = {
-        .fs_fp    = HAVE_OPT(UNIFDEF) ? popen_unifdef(fname) : fopen(fname, "r"),
+        .fs_fd    = open(fname, O_RDONLY),
         .fs_fname = fname
     };
 
-    if (fstate.fs_fp == NULL)
+    if (fstate.fs_fd < 0)
         return COMPLEXITY_EXIT_BAD_FILE;
 
-    if (! load_file(&fstate))
+    metric_phase_t phase = metrics_phase(MP_READ);
+    bool loaded = load_file(&fstate);
+    metrics_phase(phase);
+    if (! loaded) {
+        close(fstate.fs_fd);
         return COMPLEXITY_EXIT_BAD_FILE;
+    }
 
-    int proc_ct = strlen(fname) + 1;
-    fname = strdup(fname);
-    if (fname == NULL)
-        die(COMPLEXITY_EXIT_NOMEM, nomem_fmt, proc_ct);
-    proc_ct = 0;
-
-    while (find_proc_start(&fstate))
-        if (! do_proc(&fstate))
-            break;
+    res = score_text(&fstate, 0, S_ISREG(sb.st_mode) ? &sb : NULL);
+    text_buf_put((char *)fstate.fs_text);
+    close(fstate.fs_fd);
 
-    fflush(stdout);
-    free((void *)fstate.fs_text);
+    return res;
+}
 
-    HAVE_OPT(UNIFDEF) ? pclose(fstate.fs_fp) : fclose(fstate.fs_fp);
+/**
+ * Score a file as filtered by unifdef with the given arguments.
+ */
+static complexity_exit_code_t
+eval_unifdef(char const * fname, int ct, char const * const * args)
+{
+    complexity_exit_code_t res = COMPLEXITY_EXIT_BAD_FILE;
+    fstate_t     fstate  = { .fs_fname = fname };
+    uint64_t     fl_hash = hash_args(ct, args);
+    struct stat  sb      = { .st_mode = 0 };
+    char const * text;
+
+    if (dup_link(fname, fl_hash, &sb, &res)) {
+        unif_discard(fname, ct, args);
+        return res;
+    }
 
-    if (high_score > OPT_VALUE_HORRID_THRESHOLD)
-        res = COMPLEXITY_EXIT_HORRID_FUNCTION;
+    metric_phase_t phase = metrics_phase(MP_READ);
+    text = unif_text(fname, ct, args);
+    metrics_phase(phase);
+    if (text != NULL) {
+        set_text(&fstate, text);
+        res = score_text(&fstate, fl_hash, S_ISREG(sb.st_mode) ? &sb : NULL);
+    }
 
+    unif_release();
     return res;
 }
+
+/**
+ * Score a file, using the given unifdef arguments in place of the
+ * --unifdef options.  With no arguments, the file is read directly.
+ */
+complexity_exit_code_t
+complex_eval_defs(char const * fname, int ct, char const * const * defs)
+{
+    file_ord++;
+    if (! in_shard(fname) || ! sample_file(fname, file_ord))
+        return COMPLEXITY_EXIT_SUCCESS;
+
+    mem_set_file(fname);
+    if (ct == 0)
+        return eval_file(fname);
+    return eval_unifdef(fname, ct, defs);
+}
+
+/**
+ * Score the file named by --at.
+ */
+complexity_exit_code_t
+complex_eval_at(void)
+{
+    return complex_eval(at_fname);
+}
+
+complexity_exit_code_t
+complex_eval(char const * fname)
+{
+    int ct;
+    char const * const * args;
+
+    file_ord++;
+    if (! in_shard(fname) || ! sample_file(fname, file_ord))
+        return COMPLEXITY_EXIT_SUCCESS;
+
+    mem_set_file(fname);
+    if (! HAVE_OPT(UNIFDEF))
+        return eval_file(fname);
+
+    args = unif_global_args(&ct);
+    return eval_unifdef(fname, ct, args);
+}
 /*
  * Local Variables:
  * mode: C
@@ -113,7 +113,7 @@ typedef enum { TOKEN_TABLE TOKEN_MAX } token_t;
     _Ktbl_(while,   TKN_KW_WHILE)
 
 typedef struct {
-    FILE *          fs_fp;
+    int             fs_fd;      //!< open only while the text is read
     char const *    fs_fname;
     char const *    fs_text;
     char const *    fs_scan;
@@ -124,6 +124,7 @@ typedef struct {
     int             tkn_line;
     int             cur_line;
     int             nc_line;
+    int             fs_diag_ct; //!< diagnostics printed about the text
 } fstate_t;
 
 typedef struct {
@@ -135,6 +136,7 @@ typedef struct {
     int             proc_line;
     int             st_colon_need;
     int             st_depth_warned;
+    int             st_file_ix; //!< input file ordinal, for --merge
     score_t         score;
     char *          st_end;
     fstate_t *      st_fstate;
@@ -154,6 +156,59 @@ static inline void state_init(state_t * st, fstate_t * fs)
 
 #define MAX_SCORE 999999
 
+/**
+ * Histogram bucket for a score:  tens up to 100, hundreds up to 1000,
+ * then thousands.
+ */
+static inline int
+hash_score(score_t score)
+{
+    int sc = score + 0.5;
+    if (sc < 10)   return 0;
+    if (sc < 100)  return sc / 10; // 1 -> 9
+    if (sc < 1000) return 9 + (sc / 100); // 10 -> 18
+    return 18 + (sc / 1000); // 19 -> ...
+}
+
+#define METRIC_PHASE_TABLE              \
+    _Ptbl_(MP_OTHER,  "other")          \
+    _Ptbl_(MP_READ,   "read")           \
+    _Ptbl_(MP_SCORE,  "score")          \
+    _Ptbl_(MP_REPORT, "report")
+
+#define _Ptbl_(_e, _n) _e,
+typedef enum { METRIC_PHASE_TABLE MP_CT } metric_phase_t;
+#undef  _Ptbl_
+
+/**
+ * Counters for --metrics-file.  They are kept whether or not the
+ * file is wanted, since they are cheap.
+ */
+typedef struct {
+    unsigned long   mt_files;
+    unsigned long   mt_bytes;
+    unsigned long   mt_scored;
+    unsigned long   mt_ignored;
+    unsigned long   mt_spawned;
+    unsigned long   mt_reused;      //!< scores copied from the body memo
+    metric_phase_t  mt_phase;
+    double          mt_seconds[MP_CT];
+} metrics_t;
+
+extern metrics_t run_metrics;
+
+#define MEM_KIND_TABLE                  \
+    _Mtbl_(MEM_TEXT,   "source text")   \
+    _Mtbl_(MEM_STATE,  "proc records")  \
+    _Mtbl_(MEM_SCORES, "score list")    \
+    _Mtbl_(MEM_NAMES,  "file names")    \
+    _Mtbl_(MEM_ROLLUP, "rollup tree")   \
+    _Mtbl_(MEM_MEMO,   "body memo")
+
+#define _Mtbl_(_e, _n) _e,
+typedef enum { MEM_KIND_TABLE MEM_CT } mem_kind_t;
+#undef  _Mtbl_
+
 extern score_t penalty;
 extern score_t subexp_penalty;
 extern score_t scaling;
@@ -167,6 +222,9 @@ unget_token(fstate_t * fs);
 extern bool
 find_proc_start(fstate_t * fs);
 
+extern bool
+check_proc_start(fstate_t * fs);
+
 extern void
 do_column_totals(void);
 
@@ -182,6 +240,147 @@ do_summary(complexity_exit_code_t);
 extern void
 score_proc(state_t * score);
 
+extern void
+budget_start(void);
+
+extern void
+budget_file_start(void);
+
+extern bool
+budget_file_spent(void);
+
+extern complexity_exit_code_t
+complex_eval(char const * fname);
+
+extern complexity_exit_code_t
+complex_eval_at(void);
+
+extern complexity_exit_code_t
+complex_eval_text(char const * fname, char const * text);
+
+extern complexity_exit_code_t
+complex_eval_defs(char const * fname, int ct, char const * const * defs);
+
+extern complexity_exit_code_t
+archive_eval(void);
+
+extern complexity_exit_code_t
+compdb_eval(void);
+
+extern state_t * const *
+scores_since(int first);
+
+extern int
+unscored_count(void);
+
+extern void
+forget_scores(state_t * const * recs, int ct, int unscored);
+
+extern int
+folded_count(void);
+
+extern void
+merge_score(state_t * pstate);
+
+extern void
+merge_counts(int unscored, int folded);
+
+extern void
+shard_start(void);
+
+extern bool
+in_shard(char const * fname);
+
+extern void
+sample_start(int argc, char ** argv);
+
+extern bool
+in_sample(char const * fname);
+
+extern bool
+sample_file(char const * fname, int ord);
+
+extern void
+sample_report(void);
+
+extern complexity_exit_code_t
+save_partial(void);
+
+extern complexity_exit_code_t
+merge_partials(void);
+
+extern complexity_exit_code_t
+save_db(void);
+
+extern complexity_exit_code_t
+query_db(void);
+
+extern void
+rollup_start(void);
+
+extern void
+rollup_add(state_t const * pstate);
+
+extern void
+rollup_print(void);
+
+extern bool
+memo_find(state_t * pstate);
+
+extern void
+memo_add(state_t const * pstate);
+
+extern void
+memo_report(void);
+
+extern void
+watch_tree(void);
+
+extern metric_phase_t
+metrics_phase(metric_phase_t ph);
+
+extern void
+metrics_tick(void);
+
+extern void
+metrics_start(void);
+
+extern void
+mem_account(mem_kind_t kind, long delta);
+
+extern void
+mem_set_file(char const * fname);
+
+extern void
+mem_start(void);
+
+extern char const * const *
+unif_global_args(int * ct);
+
+extern void
+unif_queue(char const * fname, int ct, char const * const * args);
+
+extern char const *
+unif_text(char const * fname, int ct, char const * const * args);
+
+extern void
+unif_release(void);
+
+extern void
+unif_discard(char const * fname, int ct, char const * const * args);
+
+#ifdef COMPLEXITY_BENCH
+typedef struct {
+    char const *    bh_name;
+    score_t      (* bh_proc)(state_t *);
+} bench_handler_t;
+
+extern bench_handler_t const bench_handlers[];
+
+extern bool
+bench_handler(bench_handler_t const * bh, state_t * sc, int ct);
+#endif /* COMPLEXITY_BENCH */
+
 #endif /* COMPLEXITY_H_GUARD */
 /*
  * Local Variables:
@@ -0,0 +1,343 @@
+
+/*
+ *  This file is part of Complexity.
+ *  Complexity Copyright (c) 2011-2020 by Bruce Korb - all rights reserved
+ *
+ *  Complexity is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Complexity is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Procedure bodies already scored in this run.  Each body is hashed
+ * from just after its opening brace through its closing brace, before
+ * it is scored, and a copy of it is kept.  A body with the same hash
+ * and the same bytes as one seen before gets the earlier score and line
+ * counts, and the scan moves past it without tokenizing it.
+ *
+ * The bytes are hashed as they are, white space and comments included.
+ * Scores charge for the non-comment lines of nested blocks and
+ * expressions, and the line counts depend on where the closing brace
+ * sits, so bodies that differ only in layout may score differently.
+ *
+ * With --dup-functions, every procedure is also listed under its body,
+ * and bodies found more than once are reported at the end.
+ */
+
+#include "opts.h"
+#include <stdint.h>
+#include <stdlib.h>
+
+static char const nomem_fmt[] = "could not allocate %d bytes\n";
+static char const memo_hdr[]  = "\nDuplicate Procedure Bodies\n"
+    "Score | ln-ct | nc-lns| copies\n";
+
+typedef struct memo_member memo_member_t;
+
+struct memo_member {
+    memo_member_t *     mm_next;
+    char const *        mm_file;
+    int                 mm_line;
+    char                mm_name[];
+};
+
+typedef struct {
+    uint64_t            me_hash;
+    size_t              me_len;
+    char *              me_body;        //!< copy, to compare byte for byte
+    score_t             me_score;
+    int                 me_line_ct;
+    int                 me_nc_line_ct;
+    int                 me_cur_lines;   //!< lines the scan moved over
+    int                 me_nc_lines;
+    int                 me_copies;
+    memo_member_t *     me_members;     //!< in the order found
+    memo_member_t **    me_tail;
+} memo_ent_t;
+
+static memo_ent_t *  memo        = NULL;
+static int           memo_ct     = 0;
+static int           memo_alloc  = 0;
+static int *         memo_index  = NULL;
+static size_t        memo_idx_ct = 0;
+static size_t        memo_mask   = 0;
+
+/*
+ * The body memo_find() just looked for, and where scoring it began.
+ */
+static char const *  pend_body;
+static uint64_t      pend_hash;
+static size_t        pend_len;
+static int           pend_line;
+static int           pend_nc_line;
+
+/**
+ * Hash a body eight bytes at a time.  A miss costs this much more than
+ * scoring alone, so it has to be well below the cost of tokenizing.
+ */
+static uint64_t
+memo_hash(char const * p, size_t len)
+{
+    uint64_t h = len * 0x9E3779B97F4A7C15ULL;
+    uint64_t w;
+
+    for (; len >= sizeof(w); len -= sizeof(w), p += sizeof(w)) {
+        memcpy(&w, p, sizeof(w));
+        h ^= w * 0xFF51AFD7ED558CCDULL;
+        h  = ((h << 31) | (h >> 33)) * 0xC4CEB9FE1A85EC53ULL;
+    }
+
+    w = 0;
+    memcpy(&w, p, len);
+    h ^= w * 0xFF51AFD7ED558CCDULL;
+
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 33;
+    h *= 0xC4CEB9FE1A85EC53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+static void
+memo_note(memo_ent_t * me, state_t const * pstate)
+{
+    size_t          len = strlen(pstate->pname) + 1;
+    memo_member_t * mm;
+
+    mem_account(MEM_MEMO, sizeof(*mm) + len);
+    mm = malloc(sizeof(*mm) + len);
+    if (mm == NULL)
+        die(COMPLEXITY_EXIT_NOMEM, nomem_fmt, (int)(sizeof(*mm) + len));
+
+    mm->mm_next = NULL;
+    mm->mm_file = pstate->st_fstate->fs_fname;
+    mm->mm_line = pstate->ln_st;
+    memcpy(mm->mm_name, pstate->pname, len);
+
+    *(me->me_tail) = mm;
+    me->me_tail    = &(mm->mm_next);
+}
+
+static void
+memo_index_add(int ix)
+{
+    size_t hx = memo[ix].me_hash & memo_mask;
+
+    while (memo_index[hx] >= 0)
+        hx = (hx + 1) & memo_mask;
+    memo_index[hx] = ix;
+}
+
+static void
+memo_grow(void)
+{
+    if (memo_ct >= memo_alloc) {
+        int    ct    = (memo_alloc == 0) ? 1024 : memo_alloc * 2;
+        size_t bytes = ct * sizeof(*memo);
+
+        mem_account(MEM_MEMO, (ct - memo_alloc) * sizeof(*memo));
+        memo = realloc(memo, bytes);
+        if (memo == NULL)
+            die(COMPLEXITY_EXIT_NOMEM, nomem_fmt, (int)bytes);
+
+        /*
+         * The member lists' tails may point into the old array.
+         */
+        for (int ix = 0; ix < memo_ct; ix++)
+            if (memo[ix].me_members == NULL)
+                memo[ix].me_tail = &(memo[ix].me_members);
+        memo_alloc = ct;
+    }
+
+    if ((size_t)(memo_ct * 2) >= memo_idx_ct) {
+        size_t ct    = (memo_idx_ct == 0) ? 2048 : memo_idx_ct * 2;
+        size_t bytes = ct * sizeof(*memo_index);
+
+        mem_account(MEM_MEMO, (ct - memo_idx_ct) * sizeof(*memo_index));
+        free(memo_index);
+        memo_index = malloc(bytes);
+        if (memo_index == NULL)
+            die(COMPLEXITY_EXIT_NOMEM, nomem_fmt, (int)bytes);
+        memset(memo_index, 0xFF, bytes);
+        memo_idx_ct = ct;
+        memo_mask   = ct - 1;
+
+        for (int ix = 0; ix < memo_ct; ix++)
+            memo_index_add(ix);
+    }
+}
+
+/**
+ * Look up the body of the procedure in "pstate", which runs from the
+ * scan point to "st_end".  When it has been scored before, the score
+ * and line counts are copied, the scan is moved past the body and true
+ * is returned.  Otherwise, memo_add() should be called once the
+ * procedure has been scored.
+ */
+bool
+memo_find(state_t * pstate)
+{
+    fstate_t *   fs   = pstate->st_fstate;
+    char const * body = fs->fs_scan;
+
+    /*
+     * Watched files are rescored as they change, so their bodies
+     * would pile up here.
+     */
+    if (HAVE_OPT(SUMMARY_ONLY) || HAVE_OPT(WATCH))
+        return false;
+
+    pend_body    = body;
+    pend_len     = pstate->st_end - body;
+    pend_hash    = memo_hash(body, pend_len);
+    pend_line    = fs->cur_line;
+    pend_nc_line = fs->nc_line;
+
+    if (memo_mask == 0)
+        return false;
+
+    for (size_t hx = pend_hash & memo_mask; memo_index[hx] >= 0;
+         hx = (hx + 1) & memo_mask) {
+        memo_ent_t * me = memo + memo_index[hx];
+
+        if (  (me->me_hash != pend_hash) || (me->me_len != pend_len)
+           || (memcmp(me->me_body, body, pend_len) != 0))
+            continue;
+
+        pstate->score         = me->me_score;
+        pstate->st_line_ct    = me->me_line_ct;
+        pstate->st_nc_line_ct = me->me_nc_line_ct;
+
+        fs->fs_scan   = pstate->st_end;
+        fs->cur_line += me->me_cur_lines;
+        fs->nc_line  += me->me_nc_lines;
+        fs->fs_bol    = false;
+        fs->last_tkn  = TKN_LIT_CBRACE;
+
+        me->me_copies++;
+        if (HAVE_OPT(DUP_FUNCTIONS))
+            memo_note(me, pstate);
+        return true;
+    }
+
+    return false;
+}
+
+/**
+ * Remember the score of the body memo_find() did not find.  Procedures
+ * that drew warnings, ran over a budget or did not end at their
+ * closing brace are scored again each time they are seen, and nothing
+ * is remembered while watching.
+ */
+void
+memo_add(state_t const * pstate)
+{
+    fstate_t const * fs = pstate->st_fstate;
+    memo_ent_t *     me;
+    char *           body;
+
+    if (  HAVE_OPT(SUMMARY_ONLY) || HAVE_OPT(WATCH)
+       || (pstate->score >= MAX_SCORE)
+       || (pstate->st_depth_warned >= 5)
+       || (fs->fs_scan != pstate->st_end))
+        return;
+
+    memo_grow();
+    mem_account(MEM_MEMO, pend_len);
+    body = malloc(pend_len);
+    if (body == NULL)
+        die(COMPLEXITY_EXIT_NOMEM, nomem_fmt, (int)pend_len);
+    memcpy(body, pend_body, pend_len);
+
+    me  = memo + memo_ct;
+    *me = (memo_ent_t) {
+        .me_hash       = pend_hash,
+        .me_len        = pend_len,
+        .me_body       = body,
+        .me_score      = pstate->score,
+        .me_line_ct    = pstate->st_line_ct,
+        .me_nc_line_ct = pstate->st_nc_line_ct,
+        .me_cur_lines  = fs->cur_line - pend_line,
+        .me_nc_lines   = fs->nc_line  - pend_nc_line,
+        .me_copies     = 1,
+        .me_members    = NULL,
+        .me_tail       = &(me->me_members)
+    };
+    memo_index_add(memo_ct++);
+
+    if (HAVE_OPT(DUP_FUNCTIONS))
+        memo_note(me, pstate);
+}
+
+static int
+compare_copies(void const * a, void const * b)
+{
+    memo_ent_t const * A = *(memo_ent_t * const *)a;
+    memo_ent_t const * B = *(memo_ent_t * const *)b;
+
+    if (A->me_copies != B->me_copies)
+        return (A->me_copies > B->me_copies) ? -1 : 1;
+    if (A->me_score != B->me_score)
+        return (A->me_score > B->me_score) ? -1 : 1;
+    return (A < B) ? -1 : (A > B);
+}
+
+/**
+ * List the bodies found more than once, most copies first, with each
+ * procedure that has that body.
+ */
+void
+memo_report(void)
+{
+    memo_ent_t ** dup;
+    int           dup_ct = 0;
+
+    for (int ix = 0; ix < memo_ct; ix++)
+        if (memo[ix].me_copies > 1)
+            dup_ct++;
+    if (dup_ct == 0)
+        return;
+
+    dup = malloc(dup_ct * sizeof(*dup));
+    if (dup == NULL)
+        die(COMPLEXITY_EXIT_NOMEM, nomem_fmt, (int)(dup_ct * sizeof(*dup)));
+
+    dup_ct = 0;
+    for (int ix = 0; ix < memo_ct; ix++)
+        if (memo[ix].me_copies > 1)
+            dup[dup_ct++] = memo + ix;
+    qsort(dup, dup_ct, sizeof(*dup), compare_copies);
+
+    if (! HAVE_OPT(NO_HEADER))
+        fwrite(memo_hdr, sizeof(memo_hdr) - 1, 1, stdout);
+
+    for (int ix = 0; ix < dup_ct; ix++) {
+        memo_ent_t const * me = dup[ix];
+
+        printf("%5d  %6d  %6d  %6d\n", (int)(me->me_score + 0.5),
+               me->me_line_ct, me->me_nc_line_ct, me->me_copies);
+        for (memo_member_t const * mm = me->me_members; mm != NULL;
+             mm = mm->mm_next)
+            printf("       %s(%d): %s\n", mm->mm_file, mm->mm_line,
+                   mm->mm_name);
+    }
+
+    free(dup);
+}
+/*
+ * Local Variables:
+ * mode: C
+ * c-file-style: "stroustrup"
+ * indent-tabs-mode: nil
+ * End:
+ * end of memo.c */
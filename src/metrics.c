@@ -0,0 +1,339 @@
+
+/*
+ *  This file is part of Complexity.
+ *  Complexity Copyright (c) 2011-2020 by Bruce Korb - all rights reserved
+ *
+ *  Complexity is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Complexity is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Counters about our own run, written in the OpenMetrics text format
+ * for --metrics-file.  The file is written to a temporary name and
+ * renamed, so a collector never sees a partial file.
+ *
+ * Memory accounting for --mem-stats and --max-memory is kept here too.
+ */
+
+#include "opts.h"
+#include <limits.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <time.h>
+
+#define _Ptbl_(_e, _n) _n,
+static char const * const phase_names[] = { METRIC_PHASE_TABLE };
+#undef  _Ptbl_
+
+metrics_t run_metrics = { .mt_phase = MP_OTHER };
+
+#define _Mtbl_(_e, _n) _n,
+static char const * const mem_names[] = { MEM_KIND_TABLE };
+#undef  _Mtbl_
+
+typedef struct {
+    long            mk_cur;
+    long            mk_peak;
+    unsigned long   mk_allocs;      //!< allocations accounted
+    unsigned        mk_file_gen;    //!< "mem_gen" when mk_file was set
+    char            mk_file[1024];  //!< input being read at the peak
+} mem_kind_stat_t;
+
+static mem_kind_stat_t mem_stats[MEM_CT + 1]; // + 1 for the total
+static char const *    mem_file  = NULL;
+static unsigned        mem_gen   = 0;   //!< bumped for each new input
+static bool            mem_watch = false;
+static long            mem_limit = 0;
+
+/*
+ * Inputs read, and how many of them were read without accounting any
+ * new allocation.  Once the reused buffers have grown to fit, this
+ * should be nearly all of them.
+ */
+static unsigned long   mem_inputs     = 0;
+static unsigned long   mem_quiet      = 0;
+static unsigned long   mem_allocs_at  = 0;
+
+static bool     mt_enabled  = false;
+static double   mt_since    = 0.0;  //!< when the current phase began
+static double   mt_written  = 0.0;  //!< when the file was last written
+static char *   mt_tmp_name = NULL;
+
+static double
+now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+
+static void
+charge_phase(double tm)
+{
+    run_metrics.mt_seconds[run_metrics.mt_phase] += tm - mt_since;
+    mt_since = tm;
+}
+
+/**
+ * Switch phases, charging the time so far to the current one.
+ * The previous phase is returned so that it can be restored.
+ */
+metric_phase_t
+metrics_phase(metric_phase_t ph)
+{
+    metric_phase_t prev = run_metrics.mt_phase;
+
+    if (mt_enabled && (ph != prev))
+        charge_phase(now());
+
+    run_metrics.mt_phase = ph;
+    return prev;
+}
+
+static void
+write_counter(FILE * fp, char const * name, char const * help,
+              unsigned long val)
+{
+    fprintf(fp, "# TYPE complexity_%1$s counter\n"
+            "# HELP complexity_%1$s %2$s\n"
+            "complexity_%1$s_total %3$lu\n", name, help, val);
+}
+
+static void
+metrics_write(void)
+{
+    char const * fname = OPT_ARG(METRICS_FILE);
+    struct rusage ru;
+    FILE * fp;
+
+    charge_phase(now());
+    mt_written = mt_since;
+
+    fp = fopen(mt_tmp_name, "w");
+    if (fp == NULL) {
+        fprintf(stderr, "fs error %d (%s) opening %s\n",
+                errno, strerror(errno), mt_tmp_name);
+        return;
+    }
+
+    write_counter(fp, "files", "Source files processed.",
+                  run_metrics.mt_files);
+    write_counter(fp, "read_bytes", "Bytes of source text scanned.",
+                  run_metrics.mt_bytes);
+    write_counter(fp, "functions_scored", "Functions scored.",
+                  run_metrics.mt_scored);
+    write_counter(fp, "functions_ignored",
+                  "Functions skipped by --ignore.", run_metrics.mt_ignored);
+    write_counter(fp, "functions_unscored",
+                  "Functions that could not be scored.", unscored_count());
+    write_counter(fp, "unifdef_spawned", "unifdef processes started.",
+                  run_metrics.mt_spawned);
+    write_counter(fp, "functions_reused",
+                  "Functions given the score of an identical body.",
+                  run_metrics.mt_reused);
+    write_counter(fp, "heap_allocations",
+                  "Allocations made for text, names, scores and tables.",
+                  mem_stats[MEM_CT].mk_allocs);
+
+    fputs("# TYPE complexity_functions_kept gauge\n"
+          "# HELP complexity_functions_kept "
+          "Functions at or above the threshold.\n", fp);
+    fprintf(fp, "complexity_functions_kept %d\n", score_ct);
+
+    fputs("# TYPE complexity_phase_seconds counter\n"
+          "# HELP complexity_phase_seconds "
+          "Wall clock time spent in each phase.\n", fp);
+    for (int ix = 0; ix < MP_CT; ix++)
+        fprintf(fp, "complexity_phase_seconds_total{phase=\"%s\"} %.6f\n",
+                phase_names[ix], run_metrics.mt_seconds[ix]);
+
+    if (getrusage(RUSAGE_SELF, &ru) == 0) {
+        fputs("# TYPE complexity_peak_rss_bytes gauge\n"
+              "# HELP complexity_peak_rss_bytes "
+              "Peak resident set size.\n", fp);
+        fprintf(fp, "complexity_peak_rss_bytes %ld\n", ru.ru_maxrss * 1024L);
+    }
+
+    fputs("# EOF\n", fp);
+
+    if ((fclose(fp) != 0) || (rename(mt_tmp_name, fname) != 0))
+        fprintf(stderr, "fs error %d (%s) writing %s\n",
+                errno, strerror(errno), fname);
+}
+
+/**
+ * Write the metrics file if the --metrics-interval has passed.
+ */
+void
+metrics_tick(void)
+{
+    if (mt_enabled && HAVE_OPT(METRICS_INTERVAL)
+        && (now() - mt_written >= OPT_VALUE_METRICS_INTERVAL))
+        metrics_write();
+}
+
+/**
+ * Note the input now being processed, for blaming memory peaks.
+ */
+static void
+mem_input_done(void)
+{
+    if (mem_file == NULL)
+        return;
+    mem_inputs++;
+    if (mem_stats[MEM_CT].mk_allocs == mem_allocs_at)
+        mem_quiet++;
+}
+
+void
+mem_set_file(char const * fname)
+{
+    mem_input_done();
+    mem_allocs_at = mem_stats[MEM_CT].mk_allocs;
+    mem_file = fname;
+    mem_gen++;
+}
+
+static void
+mem_peak(mem_kind_stat_t * mk)
+{
+    mk->mk_peak = mk->mk_cur;
+    if ((mem_file != NULL) && (mk->mk_file_gen != mem_gen)) {
+        mk->mk_file_gen = mem_gen;
+        snprintf(mk->mk_file, sizeof(mk->mk_file), "%s", mem_file);
+    }
+}
+
+/**
+ * Account for memory held (delta > 0) or released (delta < 0).
+ * Growth is accounted before the allocation, so that --max-memory
+ * stops us before the allocation is attempted.
+ */
+void
+mem_account(mem_kind_t kind, long delta)
+{
+    mem_kind_stat_t * mk = mem_stats + kind;
+    mem_kind_stat_t * tt = mem_stats + MEM_CT;
+
+    mk->mk_cur += delta;
+    tt->mk_cur += delta;
+
+    if (delta <= 0)
+        return;
+
+    mk->mk_allocs++;
+    tt->mk_allocs++;
+    if (! mem_watch)
+        return;
+
+    if (mk->mk_cur > mk->mk_peak)
+        mem_peak(mk);
+    if (tt->mk_cur > tt->mk_peak)
+        mem_peak(tt);
+
+    if ((mem_limit > 0) && (tt->mk_cur > mem_limit))
+        die(COMPLEXITY_EXIT_NOMEM, "memory limit of %ld bytes exceeded "
+            "(%ld bytes of %s) while processing %s\n", mem_limit,
+            mk->mk_cur, mem_names[kind],
+            (mem_file != NULL) ? mem_file : "(no input)");
+}
+
+static void
+mem_report(void)
+{
+    fputs("\nMemory use:        peak bytes     allocs  input at peak\n",
+          stderr);
+    for (int ix = 0; ix <= MEM_CT; ix++) {
+        mem_kind_stat_t const * mk = mem_stats + ix;
+        fprintf(stderr, "  %-14s %13ld %10lu  %s\n",
+                (ix < MEM_CT) ? mem_names[ix] : "total",
+                mk->mk_peak, mk->mk_allocs,
+                (mk->mk_file[0] != NUL) ? mk->mk_file : "-");
+    }
+
+    mem_input_done();
+    mem_file = NULL;
+    fprintf(stderr, "Inputs read with no new allocation: %lu of %lu\n",
+            mem_quiet, mem_inputs);
+}
+
+/**
+ * Parse --max-memory, allowing a K, M or G suffix.
+ */
+static long
+mem_parse_limit(char const * arg)
+{
+    char * end;
+    int    shift = 0;
+    long   val;
+
+    errno = 0;
+    val   = strtol(arg, &end, 10);
+
+    switch (*end) {
+    case 'k': case 'K': shift = 10; end++; break;
+    case 'm': case 'M': shift = 20; end++; break;
+    case 'g': case 'G': shift = 30; end++; break;
+    }
+
+    if (  (*end != NUL) || (errno != 0) || (val <= 0)
+       || (val > (LONG_MAX >> shift)))
+        die(COMPLEXITY_EXIT_BAD_FILE, "invalid memory limit: %s\n", arg);
+    return val << shift;
+}
+
+/**
+ * Start tracking memory peaks for --mem-stats or --max-memory.
+ */
+void
+mem_start(void)
+{
+    mem_watch = true;
+    if (HAVE_OPT(MAX_MEMORY))
+        mem_limit = mem_parse_limit(OPT_ARG(MAX_MEMORY));
+
+    /*
+     * Pick up anything accounted before we started watching.
+     */
+    for (int ix = 0; ix <= MEM_CT; ix++)
+        mem_stats[ix].mk_peak = mem_stats[ix].mk_cur;
+
+    if (HAVE_OPT(MEM_STATS))
+        atexit(mem_report);
+}
+
+/**
+ * Start timing.  The metrics file is written once more at exit.
+ */
+void
+metrics_start(void)
+{
+    char const * fname = OPT_ARG(METRICS_FILE);
+    size_t len = strlen(fname) + sizeof(".tmp");
+
+    mt_tmp_name = malloc(len);
+    if (mt_tmp_name == NULL)
+        die(COMPLEXITY_EXIT_NOMEM, "could not allocate %d bytes\n", (int)len);
+    snprintf(mt_tmp_name, len, "%s.tmp", fname);
+
+    mt_enabled = true;
+    mt_since   = mt_written = now();
+    atexit(metrics_write);
+}
+/*
+ * Local Variables:
+ * mode: C
+ * c-file-style: "stroustrup"
+ * indent-tabs-mode: nil
+ * End:
+ * end of metrics.c */
@@ -0,0 +1,150 @@
+#  -*- Mode: awk -*-
+#
+#  This file is part of Complexity.
+#  Complexity Copyright (c) 2011-2020 by Bruce Korb - all rights reserved
+#
+#  Complexity is free software: you can redistribute it and/or modify it
+#  under the terms of the GNU General Public License as published by the
+#  Free Software Foundation, either version 3 of the License, or
+#  (at your option) any later version.
+#
+#  Complexity is distributed in the hope that it will be useful, but
+#  WITHOUT ANY WARRANTY; without even the implied warranty of
+#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+#  See the GNU General Public License for more details.
+#
+#  You should have received a copy of the GNU General Public License along
+#  with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#  Generate op-tokens.h from op-tokens.map:
+#
+#     awk -f op-tokens.awk op-tokens.map > op-tokens.h
+#
+#  The spellings form a trie.  Each trie node is a state, and carries the
+#  token and length of the longest spelling that is a prefix of it, so no
+#  backing up is needed.  A transition to a state with nowhere further to
+#  go, or out of a state with no way to continue, has OP_STOP added to it.
+#  The scanner loops until it sees OP_STOP.
+
+BEGIN {
+    for (ix = 32; ix < 127; ix++)
+        ord[sprintf("%c", ix)] = ix
+
+    state_ct = 1
+    spell[0] = ""
+    tkn[0]   = "TKN_EOF"
+    len[0]   = 1
+}
+
+/^[ \t]*(#|$)/ { next }
+
+{
+    if (NF != 2) {
+        printf "op-tokens.map line %d: expected a spelling and a token\n", \
+            NR > "/dev/stderr"
+        exit 1
+    }
+
+    st = 0
+    n  = length($1)
+    ln = 0
+
+    for (ix = 1; ix <= n; ix++) {
+        ch = substr($1, ix, 1)
+        if (ch == "\\" && substr($1, ix + 1, 1) == "0") {
+            code = 0
+            ix++
+        } else {
+            code = ord[ch]
+            ln++
+        }
+        used[code] = 1
+
+        if (! ((st, code) in next_st)) {
+            next_st[st, code] = state_ct
+            spell[state_ct] = spell[st] (code == 0 ? "\\0" : ch)
+            parent[state_ct] = st
+            state_ct++
+        }
+        has_kids[st] = 1
+        st = next_st[st, code]
+    }
+
+    if (st in tkn) {
+        printf "op-tokens.map line %d: %s is listed twice\n", \
+            NR, $1 > "/dev/stderr"
+        exit 1
+    }
+    tkn[st] = $2
+    len[st] = ln
+}
+
+END {
+    if (state_ct > 127) {
+        print "op-tokens.map: too many states" > "/dev/stderr"
+        exit 1
+    }
+
+    class_ct = 1
+    for (code = 0; code < 128; code++)
+        if (code in used)
+            class[code] = class_ct++
+
+    #  States are numbered so that parents come before children, so a
+    #  state without a spelling of its own can copy its parent's.
+    #
+    for (st = 1; st < state_ct; st++)
+        if (! (st in tkn)) {
+            tkn[st] = tkn[parent[st]]
+            len[st] = len[parent[st]]
+        }
+
+    print "/*"
+    print " *  Operator and punctuation transition tables,"
+    print " *  generated by op-tokens.awk from op-tokens.map."
+    print " *  Do not edit."
+    print " */"
+    print "#ifndef OP_TOKENS_H_GUARD"
+    print "#define OP_TOKENS_H_GUARD 1"
+    print ""
+    printf "#define OP_CLASS_CT %d\n", class_ct
+    printf "#define OP_STATE_CT %d\n", state_ct
+    print  "#define OP_STOP     0x80"
+    print ""
+    print "static unsigned char const op_class[256] = {"
+    for (code = 0; code < 128; code++)
+        if (code in used)
+            printf "    [0x%02X] = %2d, // %s\n", code, class[code], \
+                (code == 0) ? "\\0" : sprintf("%c", code)
+    print "};"
+    print ""
+    print "static unsigned char const op_next[OP_STATE_CT][OP_CLASS_CT] = {"
+    for (st = 0; st < state_ct; st++) {
+        row = sprintf("%3d", st + 128)
+        for (code = 0; code < 128; code++) {
+            if (! (code in used))
+                continue
+            if ((st, code) in next_st) {
+                to = next_st[st, code]
+                if (! (to in has_kids))
+                    to += 128
+            } else
+                to = st + 128
+            row = row sprintf(",%3d", to)
+        }
+        printf "    /* %-5s */ { %s },\n", "\"" spell[st] "\"", row
+    }
+    print "};"
+    print ""
+    print "static token_t const op_tkn[OP_STATE_CT] = {"
+    for (st = 0; st < state_ct; st++)
+        printf "    /* %-5s */ %s,\n", "\"" spell[st] "\"", tkn[st]
+    print "};"
+    print ""
+    print "static unsigned char const op_len[OP_STATE_CT] = {"
+    for (st = 0; st < state_ct; st++)
+        printf "    /* %-5s */ %d,\n", "\"" spell[st] "\"", len[st]
+    print "};"
+    print ""
+    print "#endif /* OP_TOKENS_H_GUARD */"
+}
@@ -0,0 +1,197 @@
+/*
+ *  Operator and punctuation transition tables,
+ *  generated by op-tokens.awk from op-tokens.map.
+ *  Do not edit.
+ */
+#ifndef OP_TOKENS_H_GUARD
+#define OP_TOKENS_H_GUARD 1
+
+#define OP_CLASS_CT 25
+#define OP_STATE_CT 49
+#define OP_STOP     0x80
+
+static unsigned char const op_class[256] = {
+    [0x00] =  1, // \0
+    [0x21] =  2, // !
+    [0x25] =  3, // %
+    [0x26] =  4, // &
+    [0x28] =  5, // (
+    [0x29] =  6, // )
+    [0x2A] =  7, // *
+    [0x2B] =  8, // +
+    [0x2C] =  9, // ,
+    [0x2D] = 10, // -
+    [0x2E] = 11, // .
+    [0x2F] = 12, // /
+    [0x3B] = 13, // ;
+    [0x3C] = 14, // <
+    [0x3D] = 15, // =
+    [0x3E] = 16, // >
+    [0x3F] = 17, // ?
+    [0x5B] = 18, // [
+    [0x5D] = 19, // ]
+    [0x5E] = 20, // ^
+    [0x7B] = 21, // {
+    [0x7C] = 22, // |
+    [0x7D] = 23, // }
+    [0x7E] = 24, // ~
+};
+
+static unsigned char const op_next[OP_STATE_CT][OP_CLASS_CT] = {
+    /* ""    */ { 128,128,  1,  3,  5,168,169,  8, 10,170, 14, 19, 22,171, 24, 28, 30,172,173,174, 34,175, 36,176,167 },
+    /* "!"   */ { 129,129,129,129,129,129,129,129,129,129,129,129,129,129,129,130,129,129,129,129,129,129,129,129,129 },
+    /* "!="  */ { 130,130,130,130,130,130,130,130,130,130,130,130,130,130,130,130,130,130,130,130,130,130,130,130,130 },
+    /* "%"   */ { 131,131,131,131,131,131,131,131,131,131,131,131,131,131,131,132,131,131,131,131,131,131,131,131,131 },
+    /* "%="  */ { 132,132,132,132,132,132,132,132,132,132,132,132,132,132,132,132,132,132,132,132,132,132,132,132,132 },
+    /* "&"   */ { 133,133,133,133,134,133,133,133,133,133,133,133,133,133,133,135,133,133,133,133,133,133,133,133,133 },
+    /* "&&"  */ { 134,134,134,134,134,134,134,134,134,134,134,134,134,134,134,134,134,134,134,134,134,134,134,134,134 },
+    /* "&="  */ { 135,135,135,135,135,135,135,135,135,135,135,135,135,135,135,135,135,135,135,135,135,135,135,135,135 },
+    /* "*"   */ { 136,136,136,136,136,136,136,136,136,136,136,136,136,136,136,137,136,136,136,136,136,136,136,136,136 },
+    /* "*="  */ { 137,137,137,137,137,137,137,137,137,137,137,137,137,137,137,137,137,137,137,137,137,137,137,137,137 },
+    /* "+"   */ { 138,141,138,138,138,138,138,138,139,138,138,138,138,138,138,140,138,138,138,138,138,138,138,138,138 },
+    /* "++"  */ { 139,139,139,139,139,139,139,139,139,139,139,139,139,139,139,139,139,139,139,139,139,139,139,139,139 },
+    /* "+="  */ { 140,140,140,140,140,140,140,140,140,140,140,140,140,140,140,140,140,140,140,140,140,140,140,140,140 },
+    /* "+\0" */ { 141,141,141,141,141,141,141,141,141,141,141,141,141,141,141,141,141,141,141,141,141,141,141,141,141 },
+    /* "-"   */ { 142,146,142,142,142,142,142,142,142,142,143,142,142,142,142,145,144,142,142,142,142,142,142,142,142 },
+    /* "--"  */ { 143,143,143,143,143,143,143,143,143,143,143,143,143,143,143,143,143,143,143,143,143,143,143,143,143 },
+    /* "->"  */ { 144,144,144,144,144,144,144,144,144,144,144,144,144,144,144,144,144,144,144,144,144,144,144,144,144 },
+    /* "-="  */ { 145,145,145,145,145,145,145,145,145,145,145,145,145,145,145,145,145,145,145,145,145,145,145,145,145 },
+    /* "-\0" */ { 146,146,146,146,146,146,146,146,146,146,146,146,146,146,146,146,146,146,146,146,146,146,146,146,146 },
+    /* "."   */ { 147,147,147,147,147,147,147,147,147,147,147, 20,147,147,147,147,147,147,147,147,147,147,147,147,147 },
+    /* ".."  */ { 148,148,148,148,148,148,148,148,148,148,148,149,148,148,148,148,148,148,148,148,148,148,148,148,148 },
+    /* "..." */ { 149,149,149,149,149,149,149,149,149,149,149,149,149,149,149,149,149,149,149,149,149,149,149,149,149 },
+    /* "/"   */ { 150,150,150,150,150,150,150,150,150,150,150,150,150,150,150,151,150,150,150,150,150,150,150,150,150 },
+    /* "/="  */ { 151,151,151,151,151,151,151,151,151,151,151,151,151,151,151,151,151,151,151,151,151,151,151,151,151 },
+    /* "<"   */ { 152,152,152,152,152,152,152,152,152,152,152,152,152,152, 25,155,152,152,152,152,152,152,152,152,152 },
+    /* "<<"  */ { 153,153,153,153,153,153,153,153,153,153,153,153,153,153,153,154,153,153,153,153,153,153,153,153,153 },
+    /* "<<=" */ { 154,154,154,154,154,154,154,154,154,154,154,154,154,154,154,154,154,154,154,154,154,154,154,154,154 },
+    /* "<="  */ { 155,155,155,155,155,155,155,155,155,155,155,155,155,155,155,155,155,155,155,155,155,155,155,155,155 },
+    /* "="   */ { 156,156,156,156,156,156,156,156,156,156,156,156,156,156,156,157,156,156,156,156,156,156,156,156,156 },
+    /* "=="  */ { 157,157,157,157,157,157,157,157,157,157,157,157,157,157,157,157,157,157,157,157,157,157,157,157,157 },
+    /* ">"   */ { 158,158,158,158,158,158,158,158,158,158,158,158,158,158,158,159, 32,158,158,158,158,158,158,158,158 },
+    /* ">="  */ { 159,159,159,159,159,159,159,159,159,159,159,159,159,159,159,159,159,159,159,159,159,159,159,159,159 },
+    /* ">>"  */ { 160,160,160,160,160,160,160,160,160,160,160,160,160,160,160,161,160,160,160,160,160,160,160,160,160 },
+    /* ">>=" */ { 161,161,161,161,161,161,161,161,161,161,161,161,161,161,161,161,161,161,161,161,161,161,161,161,161 },
+    /* "^"   */ { 162,162,162,162,162,162,162,162,162,162,162,162,162,162,162,163,162,162,162,162,162,162,162,162,162 },
+    /* "^="  */ { 163,163,163,163,163,163,163,163,163,163,163,163,163,163,163,163,163,163,163,163,163,163,163,163,163 },
+    /* "|"   */ { 164,164,164,164,164,164,164,164,164,164,164,164,164,164,164,165,164,164,164,164,164,164,166,164,164 },
+    /* "|="  */ { 165,165,165,165,165,165,165,165,165,165,165,165,165,165,165,165,165,165,165,165,165,165,165,165,165 },
+    /* "||"  */ { 166,166,166,166,166,166,166,166,166,166,166,166,166,166,166,166,166,166,166,166,166,166,166,166,166 },
+    /* "~"   */ { 167,167,167,167,167,167,167,167,167,167,167,167,167,167,167,167,167,167,167,167,167,167,167,167,167 },
+    /* "("   */ { 168,168,168,168,168,168,168,168,168,168,168,168,168,168,168,168,168,168,168,168,168,168,168,168,168 },
+    /* ")"   */ { 169,169,169,169,169,169,169,169,169,169,169,169,169,169,169,169,169,169,169,169,169,169,169,169,169 },
+    /* ","   */ { 170,170,170,170,170,170,170,170,170,170,170,170,170,170,170,170,170,170,170,170,170,170,170,170,170 },
+    /* ";"   */ { 171,171,171,171,171,171,171,171,171,171,171,171,171,171,171,171,171,171,171,171,171,171,171,171,171 },
+    /* "?"   */ { 172,172,172,172,172,172,172,172,172,172,172,172,172,172,172,172,172,172,172,172,172,172,172,172,172 },
+    /* "["   */ { 173,173,173,173,173,173,173,173,173,173,173,173,173,173,173,173,173,173,173,173,173,173,173,173,173 },
+    /* "]"   */ { 174,174,174,174,174,174,174,174,174,174,174,174,174,174,174,174,174,174,174,174,174,174,174,174,174 },
+    /* "{"   */ { 175,175,175,175,175,175,175,175,175,175,175,175,175,175,175,175,175,175,175,175,175,175,175,175,175 },
+    /* "}"   */ { 176,176,176,176,176,176,176,176,176,176,176,176,176,176,176,176,176,176,176,176,176,176,176,176,176 },
+};
+
+static token_t const op_tkn[OP_STATE_CT] = {
+    /* ""    */ TKN_EOF,
+    /* "!"   */ TKN_ARITH_OP,
+    /* "!="  */ TKN_REL_OP,
+    /* "%"   */ TKN_ARITH_OP,
+    /* "%="  */ TKN_ASSIGN,
+    /* "&"   */ TKN_ARITH_OP,
+    /* "&&"  */ TKN_LOGIC_AND,
+    /* "&="  */ TKN_ASSIGN,
+    /* "*"   */ TKN_ARITH_OP,
+    /* "*="  */ TKN_ASSIGN,
+    /* "+"   */ TKN_ARITH_OP,
+    /* "++"  */ TKN_ARITH_OP,
+    /* "+="  */ TKN_ASSIGN,
+    /* "+\0" */ TKN_EOF,
+    /* "-"   */ TKN_ARITH_OP,
+    /* "--"  */ TKN_ARITH_OP,
+    /* "->"  */ TKN_ARITH_OP,
+    /* "-="  */ TKN_ASSIGN,
+    /* "-\0" */ TKN_EOF,
+    /* "."   */ TKN_ARITH_OP,
+    /* ".."  */ TKN_ARITH_OP,
+    /* "..." */ TKN_ELLIPSIS,
+    /* "/"   */ TKN_ARITH_OP,
+    /* "/="  */ TKN_ASSIGN,
+    /* "<"   */ TKN_REL_OP,
+    /* "<<"  */ TKN_ARITH_OP,
+    /* "<<=" */ TKN_ASSIGN,
+    /* "<="  */ TKN_REL_OP,
+    /* "="   */ TKN_ASSIGN,
+    /* "=="  */ TKN_REL_OP,
+    /* ">"   */ TKN_REL_OP,
+    /* ">="  */ TKN_REL_OP,
+    /* ">>"  */ TKN_ARITH_OP,
+    /* ">>=" */ TKN_ASSIGN,
+    /* "^"   */ TKN_ARITH_OP,
+    /* "^="  */ TKN_ASSIGN,
+    /* "|"   */ TKN_ARITH_OP,
+    /* "|="  */ TKN_ASSIGN,
+    /* "||"  */ TKN_LOGIC_OR,
+    /* "~"   */ TKN_ARITH_OP,
+    /* "("   */ TKN_LIT_OPNPAREN,
+    /* ")"   */ TKN_LIT_CLSPAREN,
+    /* ","   */ TKN_LIT_COMMA,
+    /* ";"   */ TKN_LIT_SEMI,
+    /* "?"   */ TKN_LIT_QUESTION,
+    /* "["   */ TKN_LIT_OPNBRACK,
+    /* "]"   */ TKN_LIT_CLSBRACK,
+    /* "{"   */ TKN_LIT_OBRACE,
+    /* "}"   */ TKN_LIT_CBRACE,
+};
+
+static unsigned char const op_len[OP_STATE_CT] = {
+    /* ""    */ 1,
+    /* "!"   */ 1,
+    /* "!="  */ 2,
+    /* "%"   */ 1,
+    /* "%="  */ 2,
+    /* "&"   */ 1,
+    /* "&&"  */ 2,
+    /* "&="  */ 2,
+    /* "*"   */ 1,
+    /* "*="  */ 2,
+    /* "+"   */ 1,
+    /* "++"  */ 2,
+    /* "+="  */ 2,
+    /* "+\0" */ 1,
+    /* "-"   */ 1,
+    /* "--"  */ 2,
+    /* "->"  */ 2,
+    /* "-="  */ 2,
+    /* "-\0" */ 1,
+    /* "."   */ 1,
+    /* ".."  */ 1,
+    /* "..." */ 3,
+    /* "/"   */ 1,
+    /* "/="  */ 2,
+    /* "<"   */ 1,
+    /* "<<"  */ 2,
+    /* "<<=" */ 3,
+    /* "<="  */ 2,
+    /* "="   */ 1,
+    /* "=="  */ 2,
+    /* ">"   */ 1,
+    /* ">="  */ 2,
+    /* ">>"  */ 2,
+    /* ">>=" */ 3,
+    /* "^"   */ 1,
+    /* "^="  */ 2,
+    /* "|"   */ 1,
+    /* "|="  */ 2,
+    /* "||"  */ 2,
+    /* "~"   */ 1,
+    /* "("   */ 1,
+    /* ")"   */ 1,
+    /* ","   */ 1,
+    /* ";"   */ 1,
+    /* "?"   */ 1,
+    /* "["   */ 1,
+    /* "]"   */ 1,
+    /* "{"   */ 1,
+    /* "}"   */ 1,
+};
+
+#endif /* OP_TOKENS_H_GUARD */
+/* sum: op-tokens.map = 45479.3.op-tokens.map */
@@ -0,0 +1,292 @@
+
+/*
+ *  This file is part of Complexity.
+ *  Complexity Copyright (c) 2011-2020 by Bruce Korb - all rights reserved
+ *
+ *  Complexity is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Complexity is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Sharded runs.  --shard picks a stable subset of the input files,
+ * --partial saves the kept scores and --merge reads them back.  The
+ * histogram, percentiles and totals are all derived from the kept
+ * scores, so merging the records is enough to reproduce them.
+ *
+ * The partial file is text:
+ *
+ *   complexity-partial 1
+ *   unscored <count>
+ *   folded <count>
+ *   F <file ordinal> <file name>
+ *   P <score> <line-ct> <nc-line-ct> <line> <proc-name>
+ *
+ * "P" lines belong to the preceding "F" line.  The file ordinal is the
+ * position of the file in the whole input, counting files skipped by
+ * --shard.  Merged scores are kept in that order, so that ties sort
+ * just as they would in a single run.
+ */
+
+#include "opts.h"
+#include <stdint.h>
+#include <stdlib.h>
+
+static char const nomem_fmt[]   = "could not allocate %d bytes\n";
+static char const partial_hdr[] = "complexity-partial 1\n";
+
+typedef struct {
+    state_t *       me_st;
+    int             me_seq;     //!< order read, for a stable sort
+} merge_ent_t;
+
+static merge_ent_t * merged      = NULL;
+static int           merge_ct    = 0;
+static int           merge_alloc = 0;
+
+static unsigned long shard_ix    = 0;
+static unsigned long shard_ct    = 0;
+
+/**
+ * Parse the --shard argument.
+ */
+void
+shard_start(void)
+{
+    char const * arg = OPT_ARG(SHARD);
+    char * end;
+
+    shard_ix = strtoul(arg, &end, 10);
+    if (*end == '/')
+        shard_ct = strtoul(end + 1, &end, 10);
+
+    if ((*end != NUL) || (shard_ct == 0) || (shard_ix >= shard_ct)) {
+        fprintf(stderr, "invalid shard: %s\n"
+                "\tuse <index>/<count>, with the index from 0\n", arg);
+        USAGE(EXIT_FAILURE);
+    }
+}
+
+/**
+ * Decide whether a file belongs to this shard.  The choice depends
+ * only upon the file name, so every shard agrees on it.
+ */
+bool
+in_shard(char const * fname)
+{
+    uint32_t h = 2166136261U;
+
+    if (! HAVE_OPT(SHARD))
+        return true;
+
+    while (*fname != NUL)
+        h = (h ^ (unsigned char)*(fname++)) * 16777619U;
+
+    return (h % shard_ct) == shard_ix;
+}
+
+/**
+ * Write the kept scores to the --partial file.
+ */
+complexity_exit_code_t
+save_partial(void)
+{
+    char const * fname = OPT_ARG(PARTIAL);
+    char const * cur   = NULL;
+    state_t * const * recs = scores_since(0);
+    FILE * fp = fopen(fname, "w");
+
+    if (fp == NULL) {
+        fprintf(stderr, "fs error %d (%s) opening %s\n",
+                errno, strerror(errno), fname);
+        return COMPLEXITY_EXIT_BAD_FILE;
+    }
+
+    fputs(partial_hdr, fp);
+    fprintf(fp, "unscored %d\nfolded %d\n", unscored_count(),
+            folded_count());
+
+    for (int ix = 0; ix < score_ct; ix++) {
+        state_t const * st = recs[ix];
+
+        if (st->st_end != cur) {
+            cur = st->st_end;
+            fprintf(fp, "F %d %s\n", st->st_file_ix, cur);
+        }
+        fprintf(fp, "P %.17g %d %d %d %s\n", st->score, st->st_line_ct,
+                st->st_nc_line_ct, st->ln_st, st->pname);
+    }
+
+    if (fclose(fp) != 0) {
+        fprintf(stderr, "fs error %d (%s) writing %s\n",
+                errno, strerror(errno), fname);
+        return COMPLEXITY_EXIT_BAD_FILE;
+    }
+    return COMPLEXITY_EXIT_SUCCESS;
+}
+
+static bool
+merge_proc(char const * line, char * cur, int file_ix)
+{
+    state_t * st;
+    int pos = 0;
+
+    mem_account(MEM_STATE, sizeof(*st));
+    st = calloc(1, sizeof(*st));
+    if (st == NULL)
+        die(COMPLEXITY_EXIT_NOMEM, nomem_fmt, (int)sizeof(*st));
+
+    if (  (cur == NULL)
+       || (sscanf(line, "P %lg %d %d %d %n", &st->score, &st->st_line_ct,
+                  &st->st_nc_line_ct, &st->ln_st, &pos) != 4)
+       || (pos == 0)
+       || (strlen(line + pos) >= sizeof(st->pname))) {
+        free(st);
+        mem_account(MEM_STATE, -(long)sizeof(*st));
+        return false;
+    }
+
+    strcpy(st->pname, line + pos);
+    st->st_end     = cur;
+    st->st_file_ix = file_ix;
+
+    if (merge_ct >= merge_alloc) {
+        merge_alloc += (merge_alloc == 0) ? 1024 : merge_alloc;
+        merged = realloc(merged, merge_alloc * sizeof(*merged));
+        if (merged == NULL)
+            die(COMPLEXITY_EXIT_NOMEM, nomem_fmt,
+                (int)(merge_alloc * sizeof(*merged)));
+    }
+    merged[merge_ct] = (merge_ent_t) { .me_st = st, .me_seq = merge_ct };
+    merge_ct++;
+    return true;
+}
+
+static complexity_exit_code_t
+merge_one(char const * fname)
+{
+    FILE *  fp     = fopen(fname, "r");
+    char *  line   = NULL;
+    size_t  ln_sz  = 0;
+    char *  cur    = NULL;
+    int     file_ix = 0;
+    int     ln_no  = 0;
+    ssize_t len;
+    complexity_exit_code_t res = COMPLEXITY_EXIT_SUCCESS;
+
+    if (fp == NULL) {
+        fprintf(stderr, "fs error %d (%s) opening %s\n",
+                errno, strerror(errno), fname);
+        return COMPLEXITY_EXIT_BAD_FILE;
+    }
+
+    while ((len = getline(&line, &ln_sz, fp)) > 0) {
+        int ct;
+        bool ok = true;
+
+        if (line[len - 1] == NL)
+            line[--len] = NUL;
+        ln_no++;
+
+        if (ln_no == 1)
+            ok = (strncmp(line, partial_hdr, len) == 0)
+                && (partial_hdr[len] == NL);
+
+        else switch (line[0]) {
+        case 'F':
+        {
+            int pos = 0;
+            ok = (sscanf(line, "F %d %n", &file_ix, &pos) == 1)
+                && (pos > 0) && (line[pos] != NUL);
+            if (ok) {
+                mem_account(MEM_NAMES, len - pos + 1);
+                cur = strdup(line + pos);
+                if (cur == NULL)
+                    die(COMPLEXITY_EXIT_NOMEM, nomem_fmt, (int)len);
+            }
+            break;
+        }
+
+        case 'P':
+            ok = merge_proc(line, cur, file_ix);
+            break;
+
+        case 'u':
+            ok = (sscanf(line, "unscored %d", &ct) == 1);
+            if (ok)
+                merge_counts(ct, 0);
+            break;
+
+        case 'f':
+            ok = (sscanf(line, "folded %d", &ct) == 1);
+            if (ok)
+                merge_counts(0, ct);
+            break;
+
+        default:
+            ok = false;
+        }
+
+        if (! ok) {
+            fprintf(stderr, "partial %s: invalid line %d\n", fname, ln_no);
+            res = COMPLEXITY_EXIT_BAD_FILE;
+            break;
+        }
+    }
+
+    free(line);
+    fclose(fp);
+    return res;
+}
+
+/**
+ * Order merged scores by input file.  A file's scores all come from
+ * one partial file, already in the order they were scored.
+ */
+static int
+compare_merged(void const * a, void const * b)
+{
+    merge_ent_t const * A = a;
+    merge_ent_t const * B = b;
+
+    if (A->me_st->st_file_ix != B->me_st->st_file_ix)
+        return (A->me_st->st_file_ix < B->me_st->st_file_ix) ? -1 : 1;
+    return A->me_seq - B->me_seq;
+}
+
+/**
+ * Add the scores from every --merge file.
+ */
+complexity_exit_code_t
+merge_partials(void)
+{
+    complexity_exit_code_t res = COMPLEXITY_EXIT_SUCCESS;
+    int ct = STACKCT_OPT(MERGE);
+    char const ** al = STACKLST_OPT(MERGE);
+
+    while (ct-- > 0)
+        res |= merge_one(*(al++));
+
+    qsort(merged, merge_ct, sizeof(*merged), compare_merged);
+    for (int ix = 0; ix < merge_ct; ix++)
+        merge_score(merged[ix].me_st);
+
+    free(merged);
+    return res;
+}
+/*
+ * Local Variables:
+ * mode: C
+ * c-file-style: "stroustrup"
+ * indent-tabs-mode: nil
+ * End:
+ * end of partial.c */
@@ -0,0 +1,556 @@
+
+/*
+ *  This file is part of Complexity.
+ *  Complexity Copyright (c) 2011-2020 by Bruce Korb - all rights reserved
+ *
+ *  Complexity is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Complexity is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * The results database.  --save-db writes the kept scores to a file
+ * that --query maps into memory and searches without any parsing.
+ *
+ * Layout, in host byte order:
+ *
+ *   db_hdr_t       header
+ *   db_rec_t[]     records, sorted by file name, procedure name and line
+ *   uint32_t[]     record indexes, sorted by descending score
+ *   char[]         NUL terminated file and procedure names
+ *
+ * A procedure's stable id is its file name plus its name.  Because the
+ * records are sorted by id, all of the procedures in one directory are
+ * adjacent, so a directory prefix is found with two binary searches.
+ */
+
+#include "opts.h"
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DB_MAGIC  "CPLXDB\0\1"
+#define DB_ORDER  0x01020304U
+
+typedef struct {
+    char            dh_magic[8];
+    uint32_t        dh_order;       //!< DB_ORDER, to catch foreign files
+    uint32_t        dh_rec_ct;
+    uint64_t        dh_created;     //!< time(2) of the run
+    uint64_t        dh_rec_off;
+    uint64_t        dh_score_off;
+    uint64_t        dh_str_off;
+    uint64_t        dh_str_len;
+    uint32_t        dh_unscored;
+    uint32_t        dh_pad;
+} db_hdr_t;
+
+typedef struct {
+    uint32_t        dr_path;        //!< string table offsets
+    uint32_t        dr_name;
+    uint32_t        dr_line;
+    uint32_t        dr_line_ct;
+    uint32_t        dr_nc_line_ct;
+    uint32_t        dr_pad;
+    double          dr_score;
+} db_rec_t;
+
+typedef struct {
+    char const *        db_fname;
+    db_hdr_t const *    db_hdr;
+    db_rec_t const *    db_recs;
+    uint32_t const *    db_by_score;
+    char const *        db_strs;
+    size_t              db_size;
+} db_t;
+
+typedef struct {
+    char const *        dk_path;
+    char const *        dk_name;
+    int                 dk_line;
+    uint32_t            dk_rec;     //!< record index once sorted
+    state_t const *     dk_st;
+} db_key_t;
+
+static char const nomem_fmt[] = "could not allocate %d bytes\n";
+static char const head_fmt[]  =
+    "Score | ln-ct | nc-lns| file-name(line): proc-name\n";
+static char const line_fmt[]  = "%5d  %6d  %6d   %s(%d): %s\n";
+static char const query_usage[] =
+    "query forms:  worst:<count>[:<path-prefix>]\n"
+    "              under:<path-prefix>\n"
+    "              func:<path>:<proc-name>\n"
+    "              worse:<count>[:<path-prefix>] (requires two databases)\n";
+
+static void *
+db_alloc(size_t sz)
+{
+    void * p = malloc(sz);
+    if (p == NULL)
+        die(COMPLEXITY_EXIT_NOMEM, nomem_fmt, (int)sz);
+    return p;
+}
+
+static int
+compare_key(void const * a, void const * b)
+{
+    db_key_t const * A = a;
+    db_key_t const * B = b;
+    int res = strcmp(A->dk_path, B->dk_path);
+
+    if (res == 0)
+        res = strcmp(A->dk_name, B->dk_name);
+    if (res == 0)
+        res = A->dk_line - B->dk_line;
+    return res;
+}
+
+static db_rec_t const * by_score_recs = NULL;
+
+static int
+compare_rec_score(void const * a, void const * b)
+{
+    uint32_t ia = *(uint32_t const *)a;
+    uint32_t ib = *(uint32_t const *)b;
+    double   sa = by_score_recs[ia].dr_score;
+    double   sb = by_score_recs[ib].dr_score;
+
+    if (sa != sb)
+        return (sa > sb) ? -1 : 1;
+    return (ia < ib) ? -1 : (ia > ib);
+}
+
+/**
+ * Write the kept scores to the --save-db file.
+ */
+complexity_exit_code_t
+save_db(void)
+{
+    char const * fname = OPT_ARG(SAVE_DB);
+    state_t * const * recs = scores_since(0);
+    db_key_t *  keys   = db_alloc((score_ct + 1) * sizeof(*keys));
+    db_rec_t *  dbrecs = db_alloc((score_ct + 1) * sizeof(*dbrecs));
+    uint32_t *  order  = db_alloc((score_ct + 1) * sizeof(*order));
+    size_t      str_len = 0;
+    char *      strs;
+    char const * last_path = NULL;
+    uint32_t    last_off   = 0;
+    FILE *      fp;
+    bool        ok;
+    db_hdr_t    hdr = {
+        .dh_magic    = DB_MAGIC,
+        .dh_order    = DB_ORDER,
+        .dh_rec_ct   = score_ct,
+        .dh_created  = time(NULL),
+        .dh_unscored = unscored_count()
+    };
+
+    for (int ix = 0; ix < score_ct; ix++) {
+        keys[ix] = (db_key_t) {
+            .dk_path = recs[ix]->st_end,
+            .dk_name = recs[ix]->pname,
+            .dk_line = recs[ix]->ln_st,
+            .dk_st   = recs[ix]
+        };
+        str_len += strlen(recs[ix]->st_end) + strlen(recs[ix]->pname) + 2;
+    }
+    qsort(keys, score_ct, sizeof(*keys), compare_key);
+
+    /*
+     * Build the string table, storing each file name once.
+     */
+    strs    = db_alloc(str_len + 1);
+    str_len = 0;
+    for (int ix = 0; ix < score_ct; ix++) {
+        state_t const * st = keys[ix].dk_st;
+        size_t len;
+
+        if ((last_path == NULL) || (strcmp(last_path, st->st_end) != 0)) {
+            last_path = st->st_end;
+            last_off  = str_len;
+            len = strlen(last_path) + 1;
+            memcpy(strs + str_len, last_path, len);
+            str_len += len;
+        }
+
+        dbrecs[ix] = (db_rec_t) {
+            .dr_path       = last_off,
+            .dr_name       = str_len,
+            .dr_line       = st->ln_st,
+            .dr_line_ct    = st->st_line_ct,
+            .dr_nc_line_ct = st->st_nc_line_ct,
+            .dr_score      = st->score
+        };
+        len = strlen(st->pname) + 1;
+        memcpy(strs + str_len, st->pname, len);
+        str_len += len;
+        order[ix] = ix;
+    }
+
+    by_score_recs = dbrecs;
+    qsort(order, score_ct, sizeof(*order), compare_rec_score);
+
+    hdr.dh_rec_off   = sizeof(hdr);
+    hdr.dh_score_off = hdr.dh_rec_off   + score_ct * sizeof(*dbrecs);
+    hdr.dh_str_off   = hdr.dh_score_off + score_ct * sizeof(*order);
+    hdr.dh_str_len   = str_len;
+
+    fp = fopen(fname, "w");
+    ok = (fp != NULL)
+        && (fwrite(&hdr, sizeof(hdr), 1, fp) == 1)
+        && (fwrite(dbrecs, sizeof(*dbrecs), score_ct, fp) == (size_t)score_ct)
+        && (fwrite(order, sizeof(*order), score_ct, fp) == (size_t)score_ct)
+        && (fwrite(strs, 1, str_len, fp) == str_len);
+    if (fp != NULL)
+        ok = (fclose(fp) == 0) && ok;
+
+    free(keys);
+    free(dbrecs);
+    free(order);
+    free(strs);
+
+    if (! ok) {
+        fprintf(stderr, "fs error %d (%s) writing %s\n",
+                errno, strerror(errno), fname);
+        return COMPLEXITY_EXIT_BAD_FILE;
+    }
+    return COMPLEXITY_EXIT_SUCCESS;
+}
+
+/**
+ * Map a results database and check that its sections fit.
+ */
+static void
+db_open(db_t * db, char const * fname)
+{
+    struct stat sb;
+    int fd = open(fname, O_RDONLY);
+    db_hdr_t const * hdr;
+    uint64_t rec_ct;
+    size_t   left;
+
+    db->db_fname = fname;
+    if ((fd < 0) || (fstat(fd, &sb) != 0))
+        die(COMPLEXITY_EXIT_BAD_FILE, "fs error %d (%s) opening %s\n",
+            errno, strerror(errno), fname);
+
+    db->db_size = sb.st_size;
+    if (db->db_size < sizeof(db_hdr_t))
+        die(COMPLEXITY_EXIT_BAD_FILE, "%s: not a results database\n", fname);
+
+    hdr = mmap(NULL, db->db_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (hdr == MAP_FAILED)
+        die(COMPLEXITY_EXIT_BAD_FILE, "fs error %d (%s) mapping %s\n",
+            errno, strerror(errno), fname);
+
+    /*
+     * Each section must fit in what is left of the file.  Sizes are
+     * compared with the space remaining, so nothing can wrap around.
+     */
+    rec_ct = hdr->dh_rec_ct;
+    left   = db->db_size - sizeof(*hdr);
+    if (  (memcmp(hdr->dh_magic, DB_MAGIC, sizeof(hdr->dh_magic)) != 0)
+       || (hdr->dh_order != DB_ORDER)
+       || (hdr->dh_rec_off != sizeof(*hdr))
+       || (rec_ct > left / (sizeof(db_rec_t) + sizeof(uint32_t))))
+        die(COMPLEXITY_EXIT_BAD_FILE, "%s: not a results database\n", fname);
+
+    left -= rec_ct * (sizeof(db_rec_t) + sizeof(uint32_t));
+    if (  (hdr->dh_score_off != hdr->dh_rec_off + rec_ct * sizeof(db_rec_t))
+       || (hdr->dh_str_off   != hdr->dh_score_off + rec_ct * sizeof(uint32_t))
+       || (hdr->dh_str_len   != left)
+       || ((left > 0) && (((char const *)hdr)[db->db_size - 1] != NUL)))
+        die(COMPLEXITY_EXIT_BAD_FILE, "%s: not a results database\n", fname);
+
+    db->db_hdr      = hdr;
+    db->db_recs     = (void const *)((char const *)hdr + hdr->dh_rec_off);
+    db->db_by_score = (void const *)((char const *)hdr + hdr->dh_score_off);
+    db->db_strs     = (char const *)hdr + hdr->dh_str_off;
+
+    for (uint64_t ix = 0; ix < rec_ct; ix++)
+        if (  (db->db_recs[ix].dr_path >= hdr->dh_str_len)
+           || (db->db_recs[ix].dr_name >= hdr->dh_str_len)
+           || (db->db_by_score[ix] >= rec_ct))
+            die(COMPLEXITY_EXIT_BAD_FILE, "%s: corrupt record %d\n",
+                fname, (int)ix);
+}
+
+static inline char const *
+rec_path(db_t const * db, uint32_t ix)
+{
+    return db->db_strs + db->db_recs[ix].dr_path;
+}
+
+static inline char const *
+rec_name(db_t const * db, uint32_t ix)
+{
+    return db->db_strs + db->db_recs[ix].dr_name;
+}
+
+/**
+ * Find the range of records whose file name starts with "pfx".
+ */
+static void
+db_prefix_range(db_t const * db, char const * pfx, uint32_t * lo_p,
+                uint32_t * hi_p)
+{
+    size_t   len = strlen(pfx);
+    uint32_t lo  = 0;
+    uint32_t hi  = db->db_hdr->dh_rec_ct;
+
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (strncmp(rec_path(db, mid), pfx, len) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    *lo_p = lo;
+
+    hi = db->db_hdr->dh_rec_ct;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (strncmp(rec_path(db, mid), pfx, len) <= 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    *hi_p = lo;
+}
+
+/**
+ * Find the first record with the given id, or the record count.
+ */
+static uint32_t
+db_find(db_t const * db, char const * path, char const * name)
+{
+    uint32_t lo = 0;
+    uint32_t hi = db->db_hdr->dh_rec_ct;
+
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        int res = strcmp(rec_path(db, mid), path);
+        if (res == 0)
+            res = strcmp(rec_name(db, mid), name);
+        if (res < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    if (  (lo < db->db_hdr->dh_rec_ct)
+       && (strcmp(rec_path(db, lo), path) == 0)
+       && (strcmp(rec_name(db, lo), name) == 0))
+        return lo;
+    return db->db_hdr->dh_rec_ct;
+}
+
+static void
+print_rec(db_t const * db, uint32_t ix)
+{
+    db_rec_t const * dr = db->db_recs + ix;
+
+    printf(line_fmt, (int)(dr->dr_score + 0.5), dr->dr_line_ct,
+           dr->dr_nc_line_ct, rec_path(db, ix), dr->dr_line,
+           rec_name(db, ix));
+}
+
+static void
+print_header(db_t const * db)
+{
+    time_t when = db->db_hdr->dh_created;
+    char   buf[64];
+
+    if (HAVE_OPT(NO_HEADER))
+        return;
+
+    strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", localtime(&when));
+    printf("Results of %s from %s\n%s", db->db_fname, buf, head_fmt);
+}
+
+/**
+ * Print the "ct" highest scores, optionally limited to a path prefix.
+ * Without a prefix, the score index is already in order.
+ */
+static void
+query_worst(db_t const * db, int ct, char const * pfx)
+{
+    uint32_t lo, hi, *sel;
+
+    print_header(db);
+
+    if (pfx == NULL) {
+        for (uint32_t ix = 0; (ix < db->db_hdr->dh_rec_ct) && (ct > 0);
+             ix++, ct--)
+            print_rec(db, db->db_by_score[ix]);
+        return;
+    }
+
+    db_prefix_range(db, pfx, &lo, &hi);
+    if (hi == lo)
+        return;
+
+    sel = db_alloc((hi - lo) * sizeof(*sel));
+    for (uint32_t ix = lo; ix < hi; ix++)
+        sel[ix - lo] = ix;
+
+    by_score_recs = db->db_recs;
+    qsort(sel, hi - lo, sizeof(*sel), compare_rec_score);
+
+    for (uint32_t ix = 0; (ix < hi - lo) && (ct > 0); ix++, ct--)
+        print_rec(db, sel[ix]);
+    free(sel);
+}
+
+typedef struct {
+    uint32_t    wd_rec;
+    double      wd_old;
+    double      wd_delta;
+} worse_t;
+
+static int
+compare_worse(void const * a, void const * b)
+{
+    worse_t const * A = a;
+    worse_t const * B = b;
+
+    if (A->wd_delta != B->wd_delta)
+        return (A->wd_delta > B->wd_delta) ? -1 : 1;
+    return (A->wd_rec < B->wd_rec) ? -1 : (A->wd_rec > B->wd_rec);
+}
+
+/**
+ * Print the procedures whose scores rose the most from "old" to "db".
+ * Procedures are matched by id.  New procedures are not listed.
+ */
+static void
+query_worse(db_t const * old, db_t const * db, int ct, char const * pfx)
+{
+    uint32_t lo = 0, hi = db->db_hdr->dh_rec_ct;
+    worse_t * wl;
+    int wl_ct = 0;
+
+    if (pfx != NULL)
+        db_prefix_range(db, pfx, &lo, &hi);
+
+    wl = db_alloc((hi - lo + 1) * sizeof(*wl));
+    for (uint32_t ix = lo; ix < hi; ix++) {
+        uint32_t ox = db_find(old, rec_path(db, ix), rec_name(db, ix));
+        double   delta;
+
+        if (ox >= old->db_hdr->dh_rec_ct)
+            continue;
+        delta = db->db_recs[ix].dr_score - old->db_recs[ox].dr_score;
+        if ((int)(delta + 0.5) > 0)
+            wl[wl_ct++] = (worse_t) {
+                .wd_rec = ix, .wd_old = old->db_recs[ox].dr_score,
+                .wd_delta = delta };
+    }
+    qsort(wl, wl_ct, sizeof(*wl), compare_worse);
+
+    if (! HAVE_OPT(NO_HEADER))
+        printf("Scores rising from %s to %s\n"
+               "  Old   New  Delta  file-name(line): proc-name\n",
+               old->db_fname, db->db_fname);
+
+    for (int ix = 0; (ix < wl_ct) && (ix < ct); ix++) {
+        uint32_t rx  = wl[ix].wd_rec;
+        int      now = db->db_recs[rx].dr_score + 0.5;
+        int      was = wl[ix].wd_old + 0.5;
+
+        printf("%5d %5d %+6d  %s(%d): %s\n", was, now, now - was,
+               rec_path(db, rx), db->db_recs[rx].dr_line,
+               rec_name(db, rx));
+    }
+    free(wl);
+}
+
+/**
+ * Answer a --query from the --query-db files.
+ */
+complexity_exit_code_t
+query_db(void)
+{
+    char const *  query = OPT_ARG(QUERY);
+    char const ** dbl   = STACKLST_OPT(QUERY_DB);
+    int           db_ct = STACKCT_OPT(QUERY_DB);
+    db_t          dbs[2];
+    db_t *        db;
+    char const *  colon = strchr(query, ':');
+    char const *  arg   = (colon == NULL) ? "" : colon + 1;
+    size_t        klen  = (colon == NULL) ? strlen(query) : (size_t)(colon - query);
+    int           ct    = 0;
+    char const *  pfx   = NULL;
+
+    if (db_ct > 2)
+        die(COMPLEXITY_EXIT_BAD_FILE, "at most two --query-db files\n");
+    for (int ix = 0; ix < db_ct; ix++)
+        db_open(dbs + ix, dbl[ix]);
+    db = dbs + db_ct - 1; // the newest
+
+#define IS_QUERY(_k) ((klen == sizeof(_k) - 1) \
+                      && (strncmp(query, _k, klen) == 0))
+
+    if (IS_QUERY("worst") || IS_QUERY("worse")) {
+        char * end;
+        ct = strtol(arg, &end, 10);
+        if ((*end != NUL) && (*end != ':'))
+            ct = 0;
+        if (*end == ':')
+            pfx = end + 1;
+    }
+
+    if (IS_QUERY("worst") && (ct > 0))
+        query_worst(db, ct, pfx);
+
+    else if (IS_QUERY("under") && (*arg != NUL))
+        query_worst(db, INT32_MAX, arg);
+
+    else if (IS_QUERY("worse") && (ct > 0) && (db_ct == 2))
+        query_worse(dbs, db, ct, pfx);
+
+    else if (IS_QUERY("func") && (strrchr(arg, ':') != NULL)) {
+        char const * sep = strrchr(arg, ':');
+        char * path = db_alloc(sep - arg + 1);
+        uint32_t ix;
+
+        memcpy(path, arg, sep - arg);
+        path[sep - arg] = NUL;
+
+        print_header(db);
+        for (ix = db_find(db, path, sep + 1);
+             (ix < db->db_hdr->dh_rec_ct)
+             && (strcmp(rec_path(db, ix), path) == 0)
+             && (strcmp(rec_name(db, ix), sep + 1) == 0);
+             ix++)
+            print_rec(db, ix);
+        free(path);
+
+    } else {
+        fprintf(stderr, "invalid query: %s\n%s", query, query_usage);
+        return COMPLEXITY_EXIT_BAD_FILE;
+    }
+#undef IS_QUERY
+
+    return COMPLEXITY_EXIT_SUCCESS;
+}
+/*
+ * Local Variables:
+ * mode: C
+ * c-file-style: "stroustrup"
+ * indent-tabs-mode: nil
+ * End:
+ * end of resultdb.c */
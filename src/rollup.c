@@ -0,0 +1,306 @@
+
+/*
+ *  This file is part of Complexity.
+ *  Complexity Copyright (c) 2011-2020 by Bruce Korb - all rights reserved
+ *
+ *  Complexity is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Complexity is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Directory rollups for --rollup.  Every kept procedure is charged to
+ * each directory above its file, up to the requested depth, as it is
+ * kept.  A directory node holds the same weighted totals and histogram
+ * buckets as the overall report, plus its few highest scoring
+ * procedures, so nothing needs to be revisited at the end.
+ */
+
+#include "opts.h"
+#include <stdlib.h>
+
+static char const nomem_fmt[] = "could not allocate %d bytes\n";
+static char const rollup_hdr[] = "\nComplexity Rollup\n"
+    "Avg-Sc  Procs   nc-lns   High  directory\n";
+
+typedef struct rollup_node rollup_node_t;
+
+struct rollup_node {
+    rollup_node_t *     rn_next;    //!< next sibling
+    rollup_node_t *     rn_kids;    //!< first child
+    char *              rn_name;    //!< path prefix, ending with '/'
+    size_t              rn_len;
+    score_t             rn_score_ttl;
+    int                 rn_line_ct;
+    int                 rn_proc_ct;
+    int                 rn_high;
+    int                 rn_hist_ct;
+    int *               rn_hist;    //!< nc-lines by hash_score() bucket
+    int                 rn_top_ct;
+    state_t const *     rn_top[];   //!< highest first
+};
+
+#define ROLLUP_DEPTH_MAX 256
+
+static rollup_node_t   rollup_root;
+static int             rollup_depth = ROLLUP_DEPTH_MAX;
+static int             rollup_top   = 0;
+
+static char const *    last_file    = NULL;
+static rollup_node_t * last_chain[ROLLUP_DEPTH_MAX];
+static int             last_chain_ct = 0;
+
+/**
+ * Parse the --rollup argument.
+ */
+void
+rollup_start(void)
+{
+    char const * arg = OPT_ARG(ROLLUP);
+    char * end;
+
+    rollup_top = OPT_VALUE_ROLLUP_TOP;
+
+    if (strncmp(arg, "dir", 3) != 0)
+        goto bad_arg;
+
+    switch (arg[3]) {
+    case NUL:
+        return;
+
+    case ':':
+        rollup_depth = strtol(arg + 4, &end, 10);
+        if (  (*end == NUL) && (end > arg + 4) && (rollup_depth > 0)
+           && (rollup_depth <= ROLLUP_DEPTH_MAX))
+            return;
+    }
+
+ bad_arg:
+    fprintf(stderr, "invalid rollup: %s\n"
+            "\tuse dir or dir:<depth>, with a depth of at least 1\n", arg);
+    USAGE(EXIT_FAILURE);
+}
+
+static rollup_node_t *
+rollup_child(rollup_node_t * parent, char const * name, size_t len)
+{
+    rollup_node_t ** pp = &parent->rn_kids;
+    rollup_node_t * nd;
+    size_t sz;
+
+    for (nd = *pp; nd != NULL; nd = nd->rn_next) {
+        if ((nd->rn_len == len) && (memcmp(nd->rn_name, name, len) == 0))
+            return nd;
+        pp = &nd->rn_next;
+    }
+
+    sz = sizeof(*nd) + rollup_top * sizeof(nd->rn_top[0]);
+    mem_account(MEM_ROLLUP, sz + len + 1);
+    nd = calloc(1, sz);
+    if (nd == NULL)
+        die(COMPLEXITY_EXIT_NOMEM, nomem_fmt, (int)sz);
+
+    nd->rn_name = malloc(len + 1);
+    if (nd->rn_name == NULL)
+        die(COMPLEXITY_EXIT_NOMEM, nomem_fmt, (int)(len + 1));
+    memcpy(nd->rn_name, name, len);
+    nd->rn_name[len] = NUL;
+    nd->rn_len = len;
+
+    *pp = nd;
+    return nd;
+}
+
+/**
+ * Find (or make) the directories above a file, outermost first.
+ * Leading "./" is dropped so that "./x/y.c" and "x/y.c" agree.
+ */
+static void
+rollup_chain(char const * fname)
+{
+    rollup_node_t * nd = &rollup_root;
+    char const * name = fname;
+    char const * p;
+
+    while ((name[0] == '.') && (name[1] == '/'))
+        name += 2;
+
+    last_file     = fname;
+    last_chain_ct = 0;
+
+    for (p = strchr(name, '/'); p != NULL; p = strchr(p + 1, '/')) {
+        if (  (last_chain_ct == rollup_depth)
+           || (last_chain_ct == ROLLUP_DEPTH_MAX))
+            return;
+
+        nd = rollup_child(nd, name, p - name + 1);
+        last_chain[last_chain_ct++] = nd;
+    }
+
+    if (last_chain_ct == 0)
+        last_chain[last_chain_ct++] = rollup_child(nd, "./", 2);
+}
+
+static void
+rollup_node_add(rollup_node_t * nd, state_t const * pstate)
+{
+    int ix = hash_score(pstate->score);
+
+    nd->rn_proc_ct++;
+    if ((int)pstate->score > nd->rn_high)
+        nd->rn_high = pstate->score;
+    if (pstate->st_nc_line_ct != 0) {
+        nd->rn_score_ttl += pstate->score * pstate->st_nc_line_ct;
+        nd->rn_line_ct   += pstate->st_nc_line_ct;
+    }
+
+    if (ix >= nd->rn_hist_ct) {
+        int    ct = ix + 8;
+        size_t sz = ct * sizeof(int);
+
+        mem_account(MEM_ROLLUP, (ct - nd->rn_hist_ct) * sizeof(int));
+        nd->rn_hist = realloc(nd->rn_hist, sz);
+        if (nd->rn_hist == NULL)
+            die(COMPLEXITY_EXIT_NOMEM, nomem_fmt, (int)sz);
+        memset(nd->rn_hist + nd->rn_hist_ct, 0,
+               (ct - nd->rn_hist_ct) * sizeof(int));
+        nd->rn_hist_ct = ct;
+    }
+    nd->rn_hist[ix] += pstate->st_nc_line_ct;
+
+    /*
+     * Keep the top few, highest first.  A tie goes after the procedure
+     * already kept.
+     */
+    ix = nd->rn_top_ct;
+    if (ix == rollup_top) {
+        if ((ix == 0) || (pstate->score <= nd->rn_top[ix - 1]->score))
+            return;
+        ix--;
+    } else
+        nd->rn_top_ct++;
+
+    while ((ix > 0) && (pstate->score > nd->rn_top[ix - 1]->score)) {
+        nd->rn_top[ix] = nd->rn_top[ix - 1];
+        ix--;
+    }
+    nd->rn_top[ix] = pstate;
+}
+
+/**
+ * Charge a kept procedure to its directories.  Its "st_end" holds its
+ * file name, and consecutive procedures mostly come from one file.
+ */
+void
+rollup_add(state_t const * pstate)
+{
+    if (  (last_file == NULL)
+       || (  (pstate->st_end != last_file)
+          && (strcmp(pstate->st_end, last_file) != 0)))
+        rollup_chain(pstate->st_end);
+
+    for (int ix = 0; ix < last_chain_ct; ix++)
+        rollup_node_add(last_chain[ix], pstate);
+}
+
+static int
+compare_node_name(void const * a, void const * b)
+{
+    rollup_node_t const * A = *(rollup_node_t * const *)a;
+    rollup_node_t const * B = *(rollup_node_t * const *)b;
+    return strcmp(A->rn_name, B->rn_name);
+}
+
+/**
+ * Print the line count in each non-empty score range, in the ranges
+ * used by the histogram.
+ */
+static void
+rollup_print_hist(rollup_node_t const * nd, int indent)
+{
+    int lo = 0;
+
+    printf("%*s", 32 + indent, "");
+    for (int ix = 0; ix < nd->rn_hist_ct; ix++) {
+        int hi = (ix < 10) ? lo + 9 : (ix < 19) ? lo + 99 : lo + 999;
+
+        if (nd->rn_hist[ix] != 0)
+            printf(" %d-%d:%d", lo, hi, nd->rn_hist[ix]);
+        lo = hi + 1;
+    }
+    putc(NL, stdout);
+}
+
+static void
+rollup_print_node(rollup_node_t const * nd, int indent)
+{
+    rollup_node_t ** kids;
+    int kid_ct = 0;
+
+    if (nd != &rollup_root) {
+        score_t av = (nd->rn_line_ct > 0)
+            ? nd->rn_score_ttl / nd->rn_line_ct : 0;
+
+        printf("%6d  %5d  %7d  %5d  %*s%s\n", (int)(av + 0.5),
+               nd->rn_proc_ct, nd->rn_line_ct,
+               nd->rn_high, indent, "", nd->rn_name);
+
+        for (int ix = 0; ix < nd->rn_top_ct; ix++) {
+            state_t const * st = nd->rn_top[ix];
+            printf("%24s%5d  %*s%s(%d): %s\n", "", (int)(st->score + 0.5),
+                   indent + 2, "", st->st_end, st->ln_st, st->pname);
+        }
+
+        if (HAVE_OPT(HISTOGRAM))
+            rollup_print_hist(nd, indent);
+        indent += 2;
+    }
+
+    for (rollup_node_t * kd = nd->rn_kids; kd != NULL; kd = kd->rn_next)
+        kid_ct++;
+    if (kid_ct == 0)
+        return;
+
+    kids = malloc(kid_ct * sizeof(*kids));
+    if (kids == NULL)
+        die(COMPLEXITY_EXIT_NOMEM, nomem_fmt, (int)(kid_ct * sizeof(*kids)));
+
+    kid_ct = 0;
+    for (rollup_node_t * kd = nd->rn_kids; kd != NULL; kd = kd->rn_next)
+        kids[kid_ct++] = kd;
+    qsort(kids, kid_ct, sizeof(*kids), compare_node_name);
+
+    for (int ix = 0; ix < kid_ct; ix++)
+        rollup_print_node(kids[ix], indent);
+    free(kids);
+}
+
+/**
+ * Print the directory tree, each directory beneath its parent.
+ */
+void
+rollup_print(void)
+{
+    if (rollup_root.rn_kids == NULL)
+        return;
+
+    if (! HAVE_OPT(NO_HEADER))
+        fputs(rollup_hdr, stdout);
+    rollup_print_node(&rollup_root, 0);
+}
+/*
+ * Local Variables:
+ * mode: C
+ * c-file-style: "stroustrup"
+ * indent-tabs-mode: nil
+ * End:
+ * end of rollup.c */
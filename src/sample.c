@@ -0,0 +1,566 @@
+
+/*
+ *  This file is part of Complexity.
+ *  Complexity Copyright (c) 2011-2020 by Bruce Korb - all rights reserved
+ *
+ *  Complexity is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Complexity is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Sampled runs for --sample.  A file is in the sample if a hash of its
+ * name falls below the sampling fraction, so the same tree always gives
+ * the same sample.  For a count, or with --sample-by-dir, the file
+ * names must be on the command line, and the files with the lowest
+ * hashes are chosen (per directory, with --sample-by-dir).
+ *
+ * Files are the sampling units:  each sampled file stands for
+ * "files seen / files sampled" files of its stratum (its directory with
+ * --sample-by-dir, otherwise the whole input).  The report estimates
+ * totals with those weights and ratios as ratios of totals, using the
+ * usual linearized variances for a stratified sample of clusters.
+ * Percentile intervals use Woodruff's method:  the interval of the
+ * estimated fraction of lines at or below the percentile is mapped
+ * back through the estimated distribution.
+ */
+
+#include "opts.h"
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#define SAMPLE_Z    1.96    //!< for 95% intervals
+
+static char const nomem_fmt[]   = "could not allocate %d bytes\n";
+static char const count_fmt[]   = "%-22s%7.0f  (%.0f - %.0f)\n";
+static char const average_fmt[] = "%-22s%7.1f  (%.1f - %.1f)\n";
+static char const hist_fmt[]    = "%s %7.0f  (%.0f - %.0f)\n";
+
+typedef struct {
+    char const *    sn_name;
+    size_t          sn_dir_len;
+    double          sn_u;       //!< the file's draw, in [0, 1)
+} sample_name_t;
+
+typedef struct {
+    char *          ss_dir;
+    int             ss_seen;
+    int             ss_taken;
+} sample_stratum_t;
+
+typedef struct {
+    int             sf_ord;     //!< input file ordinal
+    int             sf_stratum;
+} sample_file_t;
+
+typedef struct {
+    int             sr_file;    //!< index into "files"
+    int             sr_score;
+    int             sr_lines;
+} sample_rec_t;
+
+static double             sample_frac = 0.0;
+static char const **      chosen      = NULL;  //!< sorted, or NULL
+static int                chosen_ct   = 0;
+
+static sample_stratum_t * strata      = NULL;
+static int                stratum_ct  = 0;
+static int *              stratum_ix  = NULL;  //!< hash of "strata"
+static int                stratum_mask = 0;
+
+static sample_file_t *    files       = NULL;
+static int                file_ct     = 0;
+static int                file_alloc  = 0;
+
+static void *
+sample_alloc(void * p, size_t sz)
+{
+    p = realloc(p, sz);
+    if (p == NULL)
+        die(COMPLEXITY_EXIT_NOMEM, nomem_fmt, (int)sz);
+    return p;
+}
+
+/**
+ * The length of the directory part of a file name, including the '/'.
+ */
+static size_t
+dir_len(char const * fname)
+{
+    char const * p = strrchr(fname, '/');
+    return (p == NULL) ? 0 : (size_t)(p - fname + 1);
+}
+
+static uint64_t
+hash_bytes(char const * p, size_t len)
+{
+    uint64_t h = 14695981039346656037ULL;
+
+    while (len-- > 0)
+        h = (h ^ (unsigned char)*(p++)) * 1099511628211ULL;
+    return h;
+}
+
+/**
+ * Map a file name to a uniform draw in [0, 1).  The hash is mixed so
+ * that names differing only in their last characters are independent.
+ */
+static double
+name_draw(char const * fname)
+{
+    uint64_t h = hash_bytes(fname, strlen(fname));
+
+    h = (h ^ (h >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    h = (h ^ (h >> 27)) * 0x94D049BB133111EBULL;
+    h ^= h >> 31;
+    return (h >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static int
+compare_name_dir_draw(void const * a, void const * b)
+{
+    sample_name_t const * A = a;
+    sample_name_t const * B = b;
+
+    if (HAVE_OPT(SAMPLE_BY_DIR)) {
+        size_t len = (A->sn_dir_len < B->sn_dir_len)
+            ? A->sn_dir_len : B->sn_dir_len;
+        int res = memcmp(A->sn_name, B->sn_name, len);
+        if (res != 0)
+            return res;
+        if (A->sn_dir_len != B->sn_dir_len)
+            return (A->sn_dir_len < B->sn_dir_len) ? -1 : 1;
+    }
+    if (A->sn_u != B->sn_u)
+        return (A->sn_u < B->sn_u) ? -1 : 1;
+    return strcmp(A->sn_name, B->sn_name);
+}
+
+static int
+compare_chosen(void const * a, void const * b)
+{
+    return strcmp(*(char const * const *)a, *(char const * const *)b);
+}
+
+/**
+ * Choose the files from the command line list:  the "want" with the
+ * lowest draws, or that fraction of each directory with --sample-by-dir
+ * (but at least one file from each).
+ */
+static void
+choose_files(int argc, char ** argv, int want)
+{
+    sample_name_t * nm = sample_alloc(NULL, argc * sizeof(*nm));
+    double frac = (want > 0) ? (double)want / argc : sample_frac;
+
+    for (int ix = 0; ix < argc; ix++)
+        nm[ix] = (sample_name_t) {
+            .sn_name    = argv[ix],
+            .sn_dir_len = dir_len(argv[ix]),
+            .sn_u       = name_draw(argv[ix]) };
+    qsort(nm, argc, sizeof(*nm), compare_name_dir_draw);
+
+    chosen = sample_alloc(NULL, argc * sizeof(*chosen));
+
+    if (! HAVE_OPT(SAMPLE_BY_DIR)) {
+        chosen_ct = (want < argc) ? want : argc;
+        for (int ix = 0; ix < chosen_ct; ix++)
+            chosen[ix] = nm[ix].sn_name;
+
+    } else for (int ix = 0; ix < argc; ) {
+        int end = ix + 1;
+        int take;
+
+        while (  (end < argc) && (nm[end].sn_dir_len == nm[ix].sn_dir_len)
+              && (memcmp(nm[end].sn_name, nm[ix].sn_name,
+                         nm[ix].sn_dir_len) == 0))
+            end++;
+
+        take = (int)(frac * (end - ix) + 0.5);
+        if (take < 1)
+            take = 1;
+        else if (take > end - ix)
+            take = end - ix;
+        while (take-- > 0)
+            chosen[chosen_ct++] = nm[ix++].sn_name;
+        ix = end;
+    }
+
+    qsort(chosen, chosen_ct, sizeof(*chosen), compare_chosen);
+    free(nm);
+}
+
+/**
+ * Parse --sample and, if need be, choose from the command line files.
+ */
+void
+sample_start(int argc, char ** argv)
+{
+    char const * arg = OPT_ARG(SAMPLE);
+    char * end;
+    long   want = 0;
+
+    if (strpbrk(arg, ".%") != NULL) {
+        sample_frac = strtod(arg, &end);
+        if (*end == '%') {
+            sample_frac /= 100.0;
+            end++;
+        }
+        if ((*end != NUL) || (sample_frac <= 0.0) || (sample_frac > 1.0))
+            goto bad_arg;
+
+    } else {
+        want = strtol(arg, &end, 10);
+        if ((*end != NUL) || (want <= 0) || (want > INT32_MAX))
+            goto bad_arg;
+    }
+
+    if ((want > 0) || HAVE_OPT(SAMPLE_BY_DIR)) {
+        if (argc < 1) {
+            fprintf(stderr, "--sample %s needs the files to be named on "
+                    "the command line\n",
+                    (want > 0) ? "with a count" : "with --sample-by-dir");
+            USAGE(EXIT_FAILURE);
+        }
+        choose_files(argc, argv, (int)want);
+    }
+    return;
+
+ bad_arg:
+    fprintf(stderr, "invalid sample: %s\n"
+            "\tuse a fraction from 0 to 1, a percentage, or a file count\n",
+            arg);
+    USAGE(EXIT_FAILURE);
+}
+
+/**
+ * Is this file in the sample?  This does not count the file, so it
+ * may be asked more than once.
+ */
+bool
+in_sample(char const * fname)
+{
+    if (! HAVE_OPT(SAMPLE))
+        return true;
+
+    if (chosen != NULL)
+        return bsearch(&fname, chosen, chosen_ct, sizeof(*chosen),
+                       compare_chosen) != NULL;
+
+    return name_draw(fname) < sample_frac;
+}
+
+static int
+find_stratum(char const * fname)
+{
+    size_t   len = HAVE_OPT(SAMPLE_BY_DIR) ? dir_len(fname) : 0;
+    uint64_t h   = hash_bytes(fname, len);
+    int      ix;
+
+    if ((stratum_ct + 1) * 2 > stratum_mask) {
+        int mask = (stratum_mask == 0) ? 63 : (stratum_mask * 2) + 1;
+
+        stratum_ix = sample_alloc(stratum_ix, (mask + 1) * sizeof(int));
+        memset(stratum_ix, 0xFF, (mask + 1) * sizeof(int));
+        stratum_mask = mask;
+
+        for (int sx = 0; sx < stratum_ct; sx++) {
+            char const * d = strata[sx].ss_dir;
+            ix = hash_bytes(d, strlen(d)) & mask;
+            while (stratum_ix[ix] >= 0)
+                ix = (ix + 1) & mask;
+            stratum_ix[ix] = sx;
+        }
+        strata = sample_alloc(strata, (mask + 1) / 2 * sizeof(*strata));
+    }
+
+    for (ix = h & stratum_mask; stratum_ix[ix] >= 0;
+         ix = (ix + 1) & stratum_mask) {
+        char const * d = strata[stratum_ix[ix]].ss_dir;
+        if ((strlen(d) == len) && (memcmp(d, fname, len) == 0))
+            return stratum_ix[ix];
+    }
+
+    stratum_ix[ix] = stratum_ct;
+    strata[stratum_ct] = (sample_stratum_t) {
+        .ss_dir = sample_alloc(NULL, len + 1) };
+    memcpy(strata[stratum_ct].ss_dir, fname, len);
+    strata[stratum_ct].ss_dir[len] = NUL;
+    return stratum_ct++;
+}
+
+/**
+ * Count an input file and say whether to score it.  "ord" is the
+ * ordinal its scores will carry.
+ */
+bool
+sample_file(char const * fname, int ord)
+{
+    int sx;
+
+    if (! HAVE_OPT(SAMPLE))
+        return true;
+
+    sx = find_stratum(fname);
+    strata[sx].ss_seen++;
+    if (! in_sample(fname))
+        return false;
+
+    strata[sx].ss_taken++;
+    if (file_ct >= file_alloc) {
+        file_alloc += (file_alloc == 0) ? 1024 : file_alloc;
+        files = sample_alloc(files, file_alloc * sizeof(*files));
+    }
+    files[file_ct++] = (sample_file_t) { .sf_ord = ord, .sf_stratum = sx };
+    return true;
+}
+
+/**
+ * Estimate the total of a per-file value over all the files seen, and
+ * the variance of that estimate.
+ */
+static double
+estimate_total(double const * val, double * var)
+{
+    double * sum   = calloc(2 * stratum_ct, sizeof(double));
+    double * sumsq = sum + stratum_ct;
+    double   ttl   = 0.0;
+    double   all   = 0.0;
+    double   allsq = 0.0;
+    double   all_s2;
+
+    if (sum == NULL)
+        die(COMPLEXITY_EXIT_NOMEM, nomem_fmt,
+            (int)(2 * stratum_ct * sizeof(double)));
+
+    for (int ix = 0; ix < file_ct; ix++) {
+        int sx = files[ix].sf_stratum;
+        sum[sx]   += val[ix];
+        sumsq[sx] += val[ix] * val[ix];
+        all       += val[ix];
+        allsq     += val[ix] * val[ix];
+    }
+
+    /*
+     * A directory with a single sampled file says nothing about its own
+     * spread.  Such directories borrow the spread of all the files.
+     */
+    all_s2 = (file_ct > 1)
+        ? (allsq - (all * all / file_ct)) / (file_ct - 1) : 0.0;
+
+    *var = 0.0;
+    for (int sx = 0; sx < stratum_ct; sx++) {
+        double big_n = strata[sx].ss_seen;
+        double n     = strata[sx].ss_taken;
+        double s2    = all_s2;
+
+        if (n == 0)
+            continue;
+        ttl += sum[sx] * big_n / n;
+
+        if (n > 1)
+            s2 = (sumsq[sx] - (sum[sx] * sum[sx] / n)) / (n - 1);
+        if (s2 > 0)
+            *var += big_n * big_n * (1 - n / big_n) * s2 / n;
+    }
+
+    free(sum);
+    return ttl;
+}
+
+/**
+ * Estimate a ratio of totals, y over x, and the variance of the ratio.
+ */
+static double
+estimate_ratio(double const * y, double const * x, double * var)
+{
+    double * d = calloc(file_ct, sizeof(*d));
+    double   vy, vx;
+    double   ty = estimate_total(y, &vy);
+    double   tx = estimate_total(x, &vx);
+    double   r  = (tx > 0) ? ty / tx : 0.0;
+
+    if (d == NULL)
+        die(COMPLEXITY_EXIT_NOMEM, nomem_fmt, (int)(file_ct * sizeof(*d)));
+
+    for (int ix = 0; ix < file_ct; ix++)
+        d[ix] = y[ix] - (r * x[ix]);
+    (void)estimate_total(d, var);
+    *var = (tx > 0) ? *var / (tx * tx) : 0.0;
+
+    free(d);
+    return r;
+}
+
+static int
+compare_file_ord(void const * a, void const * b)
+{
+    sample_file_t const * A = a;
+    sample_file_t const * B = b;
+    return A->sf_ord - B->sf_ord;
+}
+
+static int
+compare_rec_score(void const * a, void const * b)
+{
+    sample_rec_t const * A = a;
+    sample_rec_t const * B = b;
+    return A->sr_score - B->sr_score;
+}
+
+/**
+ * The lowest score with at least "frac" of the weighted lines at or
+ * below it.
+ */
+static int
+weighted_quantile(sample_rec_t const * rec, int rec_ct,
+                  double const * wt, double ttl, double frac)
+{
+    double cum = 0.0;
+
+    if (frac < 0.0)
+        frac = 0.0;
+    for (int ix = 0; ix < rec_ct; ix++) {
+        cum += wt[rec[ix].sr_file] * rec[ix].sr_lines;
+        if (cum >= frac * ttl)
+            return rec[ix].sr_score;
+    }
+    return (rec_ct > 0) ? rec[rec_ct - 1].sr_score : 0;
+}
+
+static void
+print_interval(char const * fmt, char const * label, double val, double var)
+{
+    double half = SAMPLE_Z * sqrt(var);
+    double lo   = (val - half < 0) ? 0 : val - half;
+
+    printf(fmt, label, val, lo, val + half);
+}
+
+/**
+ * Print the estimates for the whole input with 95% intervals.
+ */
+void
+sample_report(void)
+{
+    state_t * const * recs = scores_since(0);
+    sample_rec_t * rec;
+    double * wt;
+    double * x;
+    double * y;
+    double   var;
+    double   ttl_lines;
+    int      seen = 0;
+    static double const pct_frac[] = { 0.25, 0.50, 0.75 };
+
+    if (file_ct == 0)
+        return;
+
+    qsort(files, file_ct, sizeof(*files), compare_file_ord);
+    rec = sample_alloc(NULL, (score_ct + 1) * sizeof(*rec));
+    wt  = sample_alloc(NULL, 3 * file_ct * sizeof(double));
+    x   = wt + file_ct;
+    y   = x  + file_ct;
+    memset(x, 0, 2 * file_ct * sizeof(double));
+
+    for (int sx = 0; sx < stratum_ct; sx++)
+        seen += strata[sx].ss_seen;
+    for (int ix = 0; ix < file_ct; ix++) {
+        sample_stratum_t const * ss = strata + files[ix].sf_stratum;
+        wt[ix] = (double)ss->ss_seen / ss->ss_taken;
+    }
+
+    for (int ix = 0; ix < score_ct; ix++) {
+        sample_file_t key = { .sf_ord = recs[ix]->st_file_ix };
+        sample_file_t * sf = bsearch(&key, files, file_ct, sizeof(*files),
+                                     compare_file_ord);
+        CX_ASSERT(sf != NULL);
+        rec[ix] = (sample_rec_t) {
+            .sr_file  = (int)(sf - files),
+            .sr_score = (int)(recs[ix]->score + 0.5),
+            .sr_lines = recs[ix]->st_nc_line_ct };
+        x[rec[ix].sr_file] += recs[ix]->st_nc_line_ct;
+    }
+    qsort(rec, score_ct, sizeof(*rec), compare_rec_score);
+
+    printf("\nEstimates for %d files from %d sampled (95%% intervals)\n",
+           seen, file_ct);
+
+    for (int ix = 0; ix < score_ct; ix++)
+        y[rec[ix].sr_file] += 1.0;
+    {
+        double ttl = estimate_total(y, &var);
+        print_interval(count_fmt, "Scored procedure ct:", ttl, var);
+    }
+
+    ttl_lines = estimate_total(x, &var);
+    print_interval(count_fmt, "Non-comment line ct:", ttl_lines, var);
+
+    memset(y, 0, file_ct * sizeof(double));
+    for (int ix = 0; ix < score_ct; ix++)
+        y[rec[ix].sr_file] += (double)rec[ix].sr_score * rec[ix].sr_lines;
+    {
+        double r = estimate_ratio(y, x, &var);
+        print_interval(average_fmt, "Average line score:", r, var);
+    }
+
+    for (int px = 0; px < 3; px++) {
+        double frac = pct_frac[px];
+        int    q    = weighted_quantile(rec, score_ct, wt, ttl_lines, frac);
+        double half;
+        char   label[32];
+
+        memset(y, 0, file_ct * sizeof(double));
+        for (int ix = 0; (ix < score_ct) && (rec[ix].sr_score <= q); ix++)
+            y[rec[ix].sr_file] += rec[ix].sr_lines;
+        (void)estimate_ratio(y, x, &var);
+        half = SAMPLE_Z * sqrt(var);
+
+        snprintf(label, sizeof(label), "%d%%-ile score:", (int)(frac * 100));
+        printf("%-22s%7d  (%d - %d)\n", label, q,
+               weighted_quantile(rec, score_ct, wt, ttl_lines, frac - half),
+               weighted_quantile(rec, score_ct, wt, ttl_lines, frac + half));
+    }
+
+    if (HAVE_OPT(HISTOGRAM)) {
+        fputs("Score-Range  Lin-Ct\n", stdout);
+        for (int ix = 0; ix < score_ct; ) {
+            int bucket = hash_score(rec[ix].sr_score);
+            int lo     = (bucket < 10) ? bucket * 10
+                : (bucket < 19) ? (bucket - 9) * 100 : (bucket - 18) * 1000;
+            int hi     = (bucket < 10) ? lo + 9
+                : (bucket < 19) ? lo + 99 : lo + 999;
+            double ttl;
+            char label[32];
+
+            memset(y, 0, file_ct * sizeof(double));
+            for (; (ix < score_ct) && (hash_score(rec[ix].sr_score) == bucket);
+                 ix++)
+                y[rec[ix].sr_file] += rec[ix].sr_lines;
+
+            snprintf(label, sizeof(label), "%5d-%-5d", lo, hi);
+            ttl = estimate_total(y, &var);
+            print_interval(hist_fmt, label, ttl, var);
+        }
+    }
+
+    free(rec);
+    free(wt);
+}
+/*
+ * Local Variables:
+ * mode: C
+ * c-file-style: "stroustrup"
+ * indent-tabs-mode: nil
+ * End:
+ * end of sample.c */
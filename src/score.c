@@ -18,10 +18,19 @@
  */
 
 #include "opts.h"
+#include <limits.h>
 #include <setjmp.h>
+#include <stdlib.h>
+#include <time.h>
 
 static jmp_buf bail_on_proc;
 
+/*
+ * "longjmp(bail_on_proc)" values
+ */
+#define BAIL_INVALID    1
+#define BAIL_BUDGET     2
+
 static char const err_fmt[]    = "error: %s %s\n";
 static char const line_score[] = "line %5d score %5u\n";
 
@@ -106,17 +115,184 @@ bad_token(state_t * sc, char const * where, token_t ev)
 
     fprintf(stderr, msgfmt, sc->st_line_ct, sc->pname, sc->st_fstate->fs_fname,
             sc->proc_line + sc->st_line_ct, where, p, ev);
+    sc->st_fstate->fs_diag_ct++;
     return MAX_SCORE;
 }
 
+/*
+ * Work budgets for --proc-budget and --file-budget.  Scored tokens are
+ * counted for the whole file.  When the count reaches "tkn_check", the
+ * budgets are looked at and the next check is set.  Without budgets,
+ * the next check never comes.
+ */
+typedef struct {
+    unsigned long   bg_tokens;  //!< zero for no token limit
+    long            bg_usec;    //!< zero for no time limit
+} budget_t;
+
+#define BUDGET_TIME_TOKENS  256 //!< tokens between looks at the clock
+
+static budget_t       proc_budget, file_budget;
+static unsigned long  tkn_ct       = 0;
+static unsigned long  tkn_check    = ULONG_MAX;
+static unsigned long  proc_tkn_st  = 0;
+static long           proc_usec_st = 0;
+static long           file_usec_st = 0;
+static bool           file_spent   = false;
+
+static long
+now_usec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec * 1000000L) + (ts.tv_nsec / 1000);
+}
+
+/**
+ * Parse a budget:  a token count, or a time with a "us", "ms" or "s"
+ * suffix.
+ */
+static void
+budget_parse(budget_t * bg, char const * arg)
+{
+    char * end;
+    unsigned long val = strtoul(arg, &end, 10);
+
+    if ((end == arg) || (val == 0) || (val > LONG_MAX / 1000000))
+        goto bad_arg;
+
+    if (*end == NUL)
+        bg->bg_tokens = val;
+    else if (strcmp(end, "us") == 0)
+        bg->bg_usec = val;
+    else if (strcmp(end, "ms") == 0)
+        bg->bg_usec = val * 1000;
+    else if (strcmp(end, "s") == 0)
+        bg->bg_usec = val * 1000000;
+    else
+        goto bad_arg;
+    return;
+
+ bad_arg:
+    fprintf(stderr, "invalid budget: %s\n"
+            "\tuse a token count, or a time ending with us, ms or s\n", arg);
+    USAGE(EXIT_FAILURE);
+}
+
+/**
+ * Parse the budget options.
+ */
+void
+budget_start(void)
+{
+    if (HAVE_OPT(PROC_BUDGET))
+        budget_parse(&proc_budget, OPT_ARG(PROC_BUDGET));
+    if (HAVE_OPT(FILE_BUDGET))
+        budget_parse(&file_budget, OPT_ARG(FILE_BUDGET));
+}
+
+/**
+ * Set the token count at which the budgets are next looked at.
+ */
+static void
+budget_next_check(void)
+{
+    tkn_check = ULONG_MAX;
+
+    if (  (proc_budget.bg_tokens != 0)
+       && (proc_tkn_st + proc_budget.bg_tokens < tkn_check))
+        tkn_check = proc_tkn_st + proc_budget.bg_tokens;
+
+    if ((file_budget.bg_tokens != 0) && (file_budget.bg_tokens < tkn_check))
+        tkn_check = file_budget.bg_tokens;
+
+    if (  ((proc_budget.bg_usec != 0) || (file_budget.bg_usec != 0))
+       && (tkn_ct + BUDGET_TIME_TOKENS < tkn_check))
+        tkn_check = tkn_ct + BUDGET_TIME_TOKENS;
+}
+
+/**
+ * A new file is being scored.  Its time starts now.
+ */
+void
+budget_file_start(void)
+{
+    tkn_ct     = 0;
+    file_spent = false;
+    if (file_budget.bg_usec != 0)
+        file_usec_st = now_usec();
+}
+
+/**
+ * Has the --file-budget for the current file run out?
+ * Time is looked at here, too, so that the budget also covers the text
+ * between procedures.
+ */
+bool
+budget_file_spent(void)
+{
+    if (  ! file_spent && (file_budget.bg_usec != 0)
+       && (now_usec() - file_usec_st >= file_budget.bg_usec))
+        file_spent = true;
+    return file_spent;
+}
+
+/**
+ * The token count reached "tkn_check".  Give up on the procedure if a
+ * budget has run out.
+ */
+static void
+budget_check(state_t * sc)
+{
+    static char const spent_fmt[] =
+        "budget: %s in %s on line %d exceeded the %s budget\n";
+
+    char const * which = NULL;
+
+    if (  (file_budget.bg_tokens != 0)
+       && (tkn_ct >= file_budget.bg_tokens))
+        which = "file";
+
+    else if (  (proc_budget.bg_tokens != 0)
+            && (tkn_ct - proc_tkn_st >= proc_budget.bg_tokens))
+        which = "procedure";
+
+    else if ((proc_budget.bg_usec != 0) || (file_budget.bg_usec != 0)) {
+        long tm = now_usec();
+
+        if (  (file_budget.bg_usec != 0)
+           && (tm - file_usec_st >= file_budget.bg_usec))
+            which = "file";
+
+        else if (  (proc_budget.bg_usec != 0)
+                && (tm - proc_usec_st >= proc_budget.bg_usec))
+            which = "procedure";
+    }
+
+    if (which == NULL) {
+        budget_next_check();
+        return;
+    }
+
+    if (*which == 'f')
+        file_spent = true;
+    fprintf(stderr, spent_fmt, sc->pname, sc->st_fstate->fs_fname,
+            sc->proc_line, which);
+    sc->st_fstate->fs_diag_ct++;
+    longjmp(bail_on_proc, BAIL_BUDGET);
+}
+
 static token_t
 next_score_token(state_t * sc)
 {
     fstate_t * fs = sc->st_fstate;
     token_t    tk = next_token(fs);
 
+    if (++tkn_ct >= tkn_check)
+        budget_check(sc);
+
     if ((tk == TKN_EOF) || (fs->fs_scan > sc->st_end))
-        longjmp(bail_on_proc, 1);
+        longjmp(bail_on_proc, BAIL_INVALID);
 
     if (tk != TKN_KW_GOTO)
         return tk;
@@ -171,6 +347,7 @@ handle_invalid(state_t * sc)
 {
     sc->st_fstate->fs_scan = sc->st_end;
     fprintf(stderr, "invalid transition\n");
+    sc->st_fstate->fs_diag_ct++;
     return MAX_SCORE;
 }
 
@@ -824,10 +1001,22 @@ score_proc(state_t * score)
         fix_dispatch = false;
     }
 
-    if (setjmp(bail_on_proc) != 0) {
+    proc_tkn_st = tkn_ct;
+    if (proc_budget.bg_usec != 0)
+        proc_usec_st = now_usec();
+    budget_next_check();
+
+    switch (setjmp(bail_on_proc)) {
+    case 0:
+        break;
+
+    case BAIL_INVALID:
         fprintf(stderr, "end of %s() in %s reached with open control blocks\n",
                 score->pname, score->st_fstate->fs_fname);
+        score->st_fstate->fs_diag_ct++;
+        /* FALLTHROUGH */
 
+    default:
         score->score = MAX_SCORE;
         return;
     }
@@ -847,11 +1036,13 @@ score_proc(state_t * score)
                 score->proc_line, score->st_depth_warned);
         if (score->st_depth_warned >= 7)
             fputs("==>\t*seriously consider rewriting the procedure*.\n", stderr);
+        score->st_fstate->fs_diag_ct++;
     }
 
     if (score->st_fstate->fs_scan + 2 <= score->st_end) {
         fprintf(stderr, "procedure %s in %s ended before final close bracket\n",
                 score->pname, score->st_fstate->fs_fname);
+        score->st_fstate->fs_diag_ct++;
 
         score->score += penalty;
     }
@@ -880,6 +1071,46 @@ score_proc(state_t * score)
         (close_on_own_line ? 1 : 0);
     score->st_nc_line_ct = ct;
 }
+
+#ifdef COMPLEXITY_BENCH
+/*
+ * Entry points for the micro-benchmarks in bench.c.
+ */
+static score_t
+bench_subexpr(state_t * sc)
+{
+    return handle_subexpr(sc, false);
+}
+
+bench_handler_t const bench_handlers[] = {
+    { "handle_expression",  handle_expression  },
+    { "handle_subexpr",     bench_subexpr      },
+    { "handle_TKN_KW_IF",   handle_TKN_KW_IF   },
+    { "handle_TKN_KW_FOR",  handle_TKN_KW_FOR  },
+    { "handle_TKN_KW_CASE", handle_TKN_KW_CASE },
+    { NULL, NULL }
+};
+
+/**
+ * Score "ct" constructs in a row, each one read the way its handler's
+ * caller would:  the first token is read here, the rest by the handler.
+ * Returns false if the text could not be scored.
+ */
+bool
+bench_handler(bench_handler_t const * bh, state_t * sc, int ct)
+{
+    if (setjmp(bail_on_proc) != 0)
+        return false;
+
+    while (ct-- > 0) {
+        statement_depth = 0;
+        (void)next_score_token(sc);
+        if (bh->bh_proc(sc) >= MAX_SCORE)
+            return false;
+    }
+    return true;
+}
+#endif /* COMPLEXITY_BENCH */
 /*
  * Local Variables:
  * mode: C
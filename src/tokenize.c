@@ -20,6 +20,7 @@
 #define DEFINE_CPLX_CHAR_TYPE
 
 #include "opts.h"
+#include "op-tokens.h"
 
 static bool
 skip_comment(fstate_t * fs)
@@ -67,15 +68,6 @@ skip_to_eol(fstate_t * fs)
     }
 }
 
-static token_t
-bang_check(fstate_t * fs)
-{
-    if (fs->fs_scan[0] != '=')
-        return TKN_ARITH_OP; // logical not
-    fs->fs_scan++;
-    return TKN_REL_OP;       // not equal
-}
-
 static token_t
 check_quote(fstate_t * fs, char q)
 {
@@ -188,178 +180,54 @@ hash_check(fstate_t * fs)
 }
 
 static token_t
-assign_check(fstate_t * fs)
+unknown_check(fstate_t * fs)
 {
-    if (fs->fs_scan[0] != '=')
-        return TKN_ARITH_OP;
-    fs->fs_scan++;
-    return TKN_ASSIGN;
-}
+    unsigned char ch = fs->fs_scan[-1];
 
-static token_t
-amph_check(fstate_t * fs)
-{
-    if (fs->fs_scan[0] != '&')
-        return assign_check(fs);
-    fs->fs_scan++;
-    return TKN_LOGIC_AND;
-}
+    fprintf(stderr, "invalid character in %s on line %d: 0x%02X (%c)\n",
+            fs->fs_fname, fs->cur_line, ch,
+            (isprint(ch) ? ch : '?'));
+    fs->fs_diag_ct++;
 
-static token_t
-dot_check(fstate_t * fs)
-{
-    token_t res = TKN_ARITH_OP;
-    if ((fs->fs_scan[0] == '.') && (fs->fs_scan[1] == '.')) {
-        fs->fs_scan += 2;
-        res = TKN_ELLIPSIS;
-    }
-    return res;
+    return TKN_EOF;
 }
 
-static token_t
-plus_check(fstate_t * fs)
+/**
+ * Scan an operator or punctuation with the tables from op-tokens.h.
+ * The first character has been consumed already.  The longest spelling
+ * wins, and the state it stops in says which token that was.
+ */
+static inline token_t
+op_check(fstate_t * fs)
 {
-    token_t res = TKN_ARITH_OP;
-
-    switch (fs->fs_scan[0]) {
-    case '+': res = TKN_ARITH_OP; fs->fs_scan++; break;
-    case '=': res = TKN_ASSIGN;   fs->fs_scan++; break;
-    case NUL: res = TKN_EOF; break;
-    }
-
-    return res;
-}
+    char const * s  = fs->fs_scan;
+    unsigned int st = op_next[0][op_class[(unsigned char)s[-1]]];
 
-static token_t
-hyphen_check(fstate_t * fs)
-{
-    token_t res = TKN_ARITH_OP;
+    while (st < OP_STOP)
+        st = op_next[st][op_class[(unsigned char)*(s++)]];
 
-    switch (fs->fs_scan[0]) {
-    case '>':
-    case '-': res = TKN_ARITH_OP; fs->fs_scan++; break;
-    case '=': res = TKN_ASSIGN;   fs->fs_scan++; break;
-    case NUL: res = TKN_EOF; break;
-    }
+    st -= OP_STOP;
+    if (st == 0)
+        return unknown_check(fs);
 
-    return res;
+    fs->fs_scan = fs->tkn_text + op_len[st];
+    return op_tkn[st];
 }
 
 static token_t
 slash_check(fstate_t * fs)
 {
-    token_t res = TKN_ARITH_OP;
-
     switch (fs->fs_scan[0]) {
     case FSLASH:
         skip_to_eol(fs);
-        res = TKN_EMPTY;
-        break;
-
-    case '=':
-        fs->fs_scan++;
-        res = TKN_ASSIGN;
-        break;
+        return TKN_EMPTY;
 
     case '*':
-        res = skip_comment(fs) ? TKN_EMPTY : TKN_EOF;
-        break;
-    }
+        return skip_comment(fs) ? TKN_EMPTY : TKN_EOF;
 
-    return res;
-}
-
-static token_t
-less_check(fstate_t * fs)
-{
-    token_t res = TKN_REL_OP;
-
-    switch (fs->fs_scan[0]) {
-    case '<':
-        fs->fs_scan++;
-        if (fs->fs_scan[0] == '=') {
-            fs->fs_scan++;
-            res = TKN_ASSIGN;
-        }
-        else
-            res = TKN_ARITH_OP;
-        break;
-
-    case '=':
-        fs->fs_scan++;
-        break;
-    }
-
-    return res;
-}
-
-static token_t
-equal_check(fstate_t * fs)
-{
-    token_t res = TKN_ASSIGN;
-    if (fs->fs_scan[0] == '=') {
-        fs->fs_scan++;
-        res = TKN_REL_OP;
-    }
-    return res;
-}
-
-static token_t
-greater_check(fstate_t * fs)
-{
-    token_t res = TKN_REL_OP;
-
-    switch (fs->fs_scan[0]) {
-    case '>':
-        fs->fs_scan++;
-        if (fs->fs_scan[0] == '=') {
-            fs->fs_scan++;
-            res = TKN_ASSIGN;
-        }
-        else
-            res = TKN_ARITH_OP;
-        break;
-
-    case '=':
-        fs->fs_scan++;
-        break;
-    }
-
-    return res;
-}
-
-static token_t
-carat_check(fstate_t * fs)
-{
-    token_t res = TKN_ARITH_OP;
-
-    if (fs->fs_scan[0] == '=') {
-        fs->fs_scan++;
-        res = TKN_ASSIGN;
+    default:
+        return op_check(fs);
     }
-
-    return res;
-}
-
-static token_t
-vertbar_check(fstate_t * fs)
-{
-    if (fs->fs_scan[0] != '|')
-        return assign_check(fs);
-    fs->fs_scan++;
-    return TKN_LOGIC_OR;
-}
-
-static token_t
-unknown_check(fstate_t * fs)
-{
-    unsigned char ch = fs->fs_scan[-1];
-
-    fprintf(stderr, "invalid character in %s on line %d: 0x%02X (%c)\n",
-            fs->fs_fname, fs->cur_line, ch,
-            (isprint(ch) ? ch : '?'));
-
-    return TKN_EOF;
 }
 
 static token_t
@@ -493,35 +361,12 @@ next_token(fstate_t * fs)
             res = TKN_NUMBER;
             break;
 
-        case '!':     res = bang_check(   fs); break;
         case DQUOT:   res = dblquot_check(fs); break;
         case '#':     res = hash_check(   fs); break;
-        case '%':     res = assign_check( fs); break;
-        case '&':     res = amph_check(   fs); break;
-        case '*':     res = assign_check( fs); break;
-        case '+':     res = plus_check(   fs); break;
-        case '-':     res = hyphen_check( fs); break;
-        case '.':     res = dot_check(    fs); break;
         case FSLASH:  res = slash_check(  fs); break;
-        case '<':     res = less_check(   fs); break;
-        case '=':     res = equal_check(  fs); break;
-        case '>':     res = greater_check(fs); break;
         case SQUOT:   res = sglquot_check(fs); break;
-        case '^':     res = carat_check(  fs); break;
-        case '|':     res = vertbar_check(fs); break;
-
-        case '(':     res = TKN_LIT_OPNPAREN;  break;
-        case ')':     res = TKN_LIT_CLSPAREN;  break;
-        case ',':     res = TKN_LIT_COMMA;     break;
-        case ';':     res = TKN_LIT_SEMI;      break;
-        case '?':     res = TKN_LIT_QUESTION;  break;
-        case '[':     res = TKN_LIT_OPNBRACK;  break;
-        case ']':     res = TKN_LIT_CLSBRACK;  break;
-        case '{':     res = TKN_LIT_OBRACE;    break;
-        case '}':     res = TKN_LIT_CBRACE;    break;
 
         case BSLASH:  res = TKN_EMPTY;         break;
-        case '~':     res = TKN_ARITH_OP;      break;
 
         case ':':
             if (fs->fs_scan[0] == ':') {
@@ -537,9 +382,7 @@ next_token(fstate_t * fs)
             }
             break;
 
-        case '@':
-        case '`':
-        default:   res = unknown_check(fs); break;
+        default:      res = op_check(fs);      break;
         }
     } while (res == TKN_EMPTY);
 
@@ -576,6 +419,263 @@ skip_params(fstate_t * fs)
     }
 }
 
+/*
+ * Character classes for skip_region().  Names, numbers and operators
+ * are all "plain":  none of them can open or close a region.
+ */
+typedef enum {
+    SK_PLAIN = 0,
+    SK_SPACE,
+    SK_NL,
+    SK_SLASH,
+    SK_QUOTE,
+    SK_HASH,
+    SK_OBRACE,
+    SK_CBRACE,
+    SK_SEMI,
+    SK_WORD_E,                  //!< might start "extern"
+    SK_NUL,
+    SK_BAD                      //!< let next_token() complain
+} skip_class_t;
+
+static unsigned char const skip_class[256] = {
+    [NUL]         = SK_NUL,
+    [0x01 ... 0x08] = SK_BAD,
+    [HT]          = SK_SPACE,
+    [NL]          = SK_NL,
+    [VT]          = SK_SPACE,
+    [FF]          = SK_SPACE,
+    [CR]          = SK_SPACE,
+    [0x0E ... 0x1F] = SK_BAD,
+    [' ']         = SK_SPACE,
+    [DQUOT]       = SK_QUOTE,
+    ['#']         = SK_HASH,
+    [SQUOT]       = SK_QUOTE,
+    [FSLASH]      = SK_SLASH,
+    [';']         = SK_SEMI,
+    ['@']         = SK_BAD,
+    [BSLASH]      = SK_SPACE,
+    ['`']         = SK_BAD,
+    ['e']         = SK_WORD_E,
+    ['{']         = SK_OBRACE,
+    ['}']         = SK_CBRACE,
+    [0x7F ... 0xFF] = SK_BAD
+};
+
+#define SKIP_CLASS(_s)  skip_class[(unsigned char)*(_s)]
+
+/**
+ * Skip a "C" comment, the text pointer at the '*' of the comment opener.
+ * An unterminated comment runs to the NUL.
+ */
+static char const *
+skip_region_comment(char const * s, int * line)
+{
+    for (;;) {
+        s = BRK_STAR_OR_NL_CHARS(s + 1);
+        switch (*s) {
+        case NUL:
+            return s;
+        case NL:
+            (*line)++;
+            break;
+        case '*':
+            if (s[1] == FSLASH)
+                return s + 2;
+        }
+    }
+}
+
+/**
+ * Skip a preprocessing directive, just as hash_check() does.
+ * An unterminated directive runs to the NUL.
+ */
+static char const *
+skip_region_directive(char const * s, int * line)
+{
+    char const * start = ++s;
+
+    for (;;) {
+        s = BRK_END_OF_LINE_CHARS(s);
+        if (*s == NUL)
+            return s;
+
+        if ((s > start) && (s[-1] == BSLASH)) {
+            if (*(s++) == NL)
+                (*line)++;
+            continue;
+        }
+
+        return s + (((s[0] == CR) && (s[1] == NL)) ? 2 : 1);
+    }
+}
+
+/**
+ * Skip a string or character literal, just as check_quote() does.
+ * Returns NULL if it is not terminated.
+ */
+static char const *
+skip_region_quote(char const * s)
+{
+    char q = *(s++);
+
+    while (*s != q) {
+        switch (*s) {
+        case BSLASH:
+            if (*++s != NUL)
+                break;
+            /* FALLTHROUGH */
+
+        case NUL:
+            return NULL;
+        }
+        s++;
+    }
+    return s + 1;
+}
+
+/**
+ * Find the end of a region that cannot hold a procedure body:  the
+ * semi-colon at brace depth zero, or the closing brace in column 1
+ * that brings the depth to zero.  This is what skip_to_semi() would
+ * find with next_token(), but only comments, literals, directives and
+ * braces are recognized, so large initializers are crossed at the
+ * speed of a byte table lookup.  Line counts are kept exactly as
+ * next_token() keeps them.
+ *
+ * @returns the token found, TKN_EOF, or TKN_EMPTY when a character
+ * needs next_token()'s attention.  The scan state is then left at that
+ * character and "depth" is updated.
+ */
+static token_t
+skip_region(fstate_t * fs, int * depth)
+{
+    char const * s    = fs->fs_scan;
+    int          line = fs->cur_line;
+    int          nc   = fs->nc_line;
+    bool         bol  = fs->fs_bol;
+    token_t      res  = TKN_EMPTY;
+
+#define SKIP_TOKEN_START                        \
+    do { if (bol) { nc++; bol = false; } } while (0)
+
+    for (;;) {
+        switch (SKIP_CLASS(s)) {
+        case SK_PLAIN:
+            SKIP_TOKEN_START;
+            do s++; while (SKIP_CLASS(s) <= SK_SPACE);
+            continue;
+
+        case SK_SPACE:
+            do s++; while (SKIP_CLASS(s) == SK_SPACE);
+            continue;
+
+        case SK_NL:
+            line++;
+            bol = true;
+            s++;
+            continue;
+
+        case SK_SLASH:
+            if (s[1] == FSLASH) {
+                s = BRK_END_OF_LINE_CHARS(s + 2);
+                continue;
+            }
+            if (s[1] == '*') {
+                s = skip_region_comment(s + 1, &line);
+                continue;
+            }
+            SKIP_TOKEN_START;
+            s++;
+            continue;
+
+        case SK_QUOTE:
+        {
+            char const * e = skip_region_quote(s);
+            SKIP_TOKEN_START;
+            if (e == NULL) {
+                s   = s + strlen(s) + 1; // just past the NUL, as before
+                res = TKN_EOF;
+                break;
+            }
+            s = e;
+            continue;
+        }
+
+        case SK_HASH:
+            if (bol) {
+                s = skip_region_directive(s, &line);
+                continue;
+            }
+            s++;
+            continue;
+
+        case SK_WORD_E:
+            if (  (strncmp(s, "extern", 6) == 0) && ! IS_NAME_CHAR(s[6])
+               && ! IS_NAME_CHAR(s[-1])) {
+                fs->fs_scan  = s + 6;
+                fs->cur_line = line;
+                if (extern_c_check(fs) == TKN_EMPTY) {
+                    s    = fs->fs_scan;
+                    line = fs->cur_line;
+                    continue;
+                }
+            }
+            SKIP_TOKEN_START;
+            do s++; while (SKIP_CLASS(s) <= SK_SPACE);
+            continue;
+
+        case SK_OBRACE:
+            SKIP_TOKEN_START;
+            (*depth)++;
+            s++;
+            continue;
+
+        case SK_CBRACE:
+            SKIP_TOKEN_START;
+            if ((--(*depth) == 0) && (s[-1] == NL)) {
+                res = TKN_LIT_CBRACE;
+                break;
+            }
+            s++;
+            continue;
+
+        case SK_SEMI:
+            SKIP_TOKEN_START;
+            if (*depth == 0) {
+                res = TKN_LIT_SEMI;
+                break;
+            }
+            s++;
+            continue;
+
+        case SK_NUL:
+            res = TKN_EOF;
+            break;
+
+        case SK_BAD:
+        default:
+            break;
+        }
+        break;
+    }
+#undef SKIP_TOKEN_START
+
+    fs->cur_line = line;
+    fs->nc_line  = nc;
+    fs->fs_bol   = bol;
+    fs->fs_scan  = s;
+
+    if ((res == TKN_LIT_SEMI) || (res == TKN_LIT_CBRACE)) {
+        fs->tkn_text = s;
+        fs->tkn_line = line;
+        fs->tkn_len  = 1;
+        fs->fs_scan  = s + 1;
+        fs->last_tkn = res;
+    }
+    return res;
+}
+
 /*
  * quit when you find either a semi-colon or a closing brace in col 1.
  */
@@ -583,6 +683,10 @@ static token_t
 skip_to_semi(fstate_t * fs)
 {
     int depth = (fs->last_tkn == TKN_LIT_OBRACE) ? 1 : 0;
+    token_t res = skip_region(fs, &depth);
+
+    if (res != TKN_EMPTY)
+        return res;
 
     for (;;) {
         token_t tkn = next_token(fs);
@@ -670,6 +774,32 @@ find_proc_start(fstate_t * fs)
         }
     }
 }
+
+/**
+ * Check that a procedure definition starts right at the scan point:  its
+ * name, the parameter list and the opening brace, as find_proc_start()
+ * would accept them.  Nothing further on is looked at.
+ */
+bool
+check_proc_start(fstate_t * fs)
+{
+    char const * proc_name;
+    size_t       pname_len;
+
+    if (next_token(fs) != TKN_NAME)
+        return false;
+    proc_name = fs->tkn_text;
+    pname_len = fs->tkn_len;
+
+    if (  (next_token(fs)  != TKN_LIT_OPNPAREN)
+       || (skip_params(fs) != TKN_LIT_CLSPAREN)
+       || (next_token(fs)  != TKN_LIT_OBRACE))
+        return false;
+
+    fs->tkn_text = proc_name;
+    fs->tkn_len  = pname_len;
+    return true;
+}
 /*
  * Local Variables:
  * mode: C
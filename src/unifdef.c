@@ -0,0 +1,557 @@
+
+/*
+ *  This file is part of Complexity.
+ *  Complexity Copyright (c) 2011-2020 by Bruce Korb - all rights reserved
+ *
+ *  Complexity is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Complexity is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * unifdef subprocess pool.  Files whose names are known in advance are
+ * queued and up to --unif-jobs unifdef processes run ahead of the scorer.
+ * The children are started with posix_spawn(3) -- no shell -- and their
+ * output is collected into buffers that are reused from file to file.
+ */
+
+#include "opts.h"
+#include <fcntl.h>
+#include <poll.h>
+#include <spawn.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#ifndef UNIFDEF_EXE
+#define UNIFDEF_EXE "unifdef"
+#endif
+
+#define UNIF_MIN_BUF    (64 * 1024)
+#define UNIF_PIPE_SIZE  (1024 * 1024)
+
+extern char ** environ;
+
+typedef enum {
+    US_IDLE,        //!< nothing assigned
+    US_RUNNING,     //!< child started, output being collected
+    US_DONE,        //!< output complete, not yet claimed
+    US_IN_USE       //!< text handed to the scorer
+} unif_state_t;
+
+typedef struct {
+    char const *            uq_fname;
+    int                     uq_arg_ct;
+    char const * const *    uq_args;
+} unif_req_t;
+
+typedef struct {
+    unif_state_t    us_state;
+    unif_req_t      us_req;
+    pid_t           us_pid;
+    int             us_fd;
+    bool            us_ok;
+    char *          us_buf;
+    size_t          us_size;
+    size_t          us_len;
+} unif_slot_t;
+
+static char const   nomem_fmt[] = "could not allocate %d bytes\n";
+
+static unif_slot_t * slots      = NULL;
+static int           slot_ct    = 0;
+static int           job_ct     = 0;
+static int           running_ct = 0;
+
+static unif_req_t *  queue      = NULL;
+static int           q_head     = 0;
+static int           q_tail     = 0;
+static int           q_alloc    = 0;
+
+static struct pollfd * poll_fds = NULL;
+static int *           poll_ix  = NULL;
+static char const **   spawn_av = NULL;
+static int             spawn_av_ct = 0;
+
+static void *
+unif_alloc(void * p, size_t sz)
+{
+    p = realloc(p, sz);
+    if (p == NULL)
+        die(COMPLEXITY_EXIT_NOMEM, nomem_fmt, (int)sz);
+    return p;
+}
+
+static void
+unif_init(void)
+{
+    job_ct  = HAVE_OPT(UNIF_JOBS) ? OPT_VALUE_UNIF_JOBS : 4;
+    if (job_ct < 1)
+        job_ct = 1;
+
+    /*
+     * One extra slot holds the text currently being scored.
+     */
+    slot_ct  = job_ct + 1;
+    slots    = unif_alloc(NULL, slot_ct * sizeof(*slots));
+    poll_fds = unif_alloc(NULL, slot_ct * sizeof(*poll_fds));
+    poll_ix  = unif_alloc(NULL, slot_ct * sizeof(*poll_ix));
+    memset(slots, 0, slot_ct * sizeof(*slots));
+}
+
+/**
+ * Copy one word of a --unifdef option, removing the quoting the shell
+ * would have removed:  single quotes, double quotes and backslashes.
+ * Nothing is expanded.  "*pp" is left just past the word.
+ */
+static char *
+unif_word(char const ** pp, char const * opt)
+{
+    char const * p   = *pp;
+    char *       res = unif_alloc(NULL, strlen(p) + 1);
+    char *       d   = res;
+    char         q   = NUL; // the open quote, if any
+
+    for (;;) {
+        char ch = *(p++);
+
+        switch (ch) {
+        case NUL:
+            if (q != NUL) {
+                fprintf(stderr, "unmatched %c in --unifdef option:  %s\n",
+                        q, opt);
+                USAGE(EXIT_FAILURE);
+            }
+            p--;
+            goto done;
+
+        case SQUOT:
+        case DQUOT:
+            if (q == NUL) {
+                q = ch;
+                continue;
+            }
+            if (q == ch) {
+                q = NUL;
+                continue;
+            }
+            break;
+
+        case BSLASH:
+            if ((q == SQUOT) || (*p == NUL))
+                break;
+            if ((q == DQUOT) && (strchr("\\\"$`", *p) == NULL))
+                break;
+            ch = *(p++);
+            break;
+
+        default:
+            if ((q == NUL) && IS_SPACE_CHAR(ch))
+                goto done;
+        }
+        *(d++) = ch;
+    }
+
+ done:
+    *d  = NUL;
+    *pp = p;
+    return res;
+}
+
+/**
+ * The --unifdef options used to be handed to the shell, so split them
+ * into words the same way (minus any expansions) for posix_spawn.
+ */
+char const * const *
+unif_global_args(int * ct)
+{
+    static char const ** args = NULL;
+    static int           arg_ct = 0;
+
+    if (args == NULL) {
+        int ix = STACKCT_OPT(UNIFDEF);
+        char const ** ov = STACKLST_OPT(UNIFDEF);
+        size_t len = 1;
+
+        for (int i = 0; i < ix; i++)
+            len += strlen(ov[i]) + 1;
+        args = unif_alloc(NULL, len * sizeof(*args));
+
+        while (ix-- > 0) {
+            char const * opt = *(ov++);
+            char const * p   = opt;
+
+            for (;;) {
+                p = SPN_SPACE_CHARS(p);
+                if (*p == NUL)
+                    break;
+                args[arg_ct++] = unif_word(&p, opt);
+            }
+        }
+    }
+
+    *ct = arg_ct;
+    return args;
+}
+
+static bool
+same_req(unif_req_t const * a, char const * fname, int ct,
+         char const * const * args)
+{
+    return (a->uq_args == args) && (a->uq_arg_ct == ct)
+        && (strcmp(a->uq_fname, fname) == 0);
+}
+
+static void
+set_cloexec(int fd)
+{
+    int fl = fcntl(fd, F_GETFD);
+    if (fl >= 0)
+        (void)fcntl(fd, F_SETFD, fl | FD_CLOEXEC);
+}
+
+/**
+ * Start unifdef for the request assigned to this slot.
+ */
+static void
+unif_spawn(unif_slot_t * us)
+{
+    posix_spawn_file_actions_t fa;
+    unif_req_t * rq = &us->us_req;
+    int  pfd[2];
+    int  err;
+    char const * exe = HAVE_OPT(UNIF_EXE) ? OPT_ARG(UNIF_EXE) : UNIFDEF_EXE;
+
+    us->us_len   = 0;
+    us->us_ok    = false;
+    us->us_state = US_DONE;
+
+    if (spawn_av_ct < rq->uq_arg_ct + 3) {
+        spawn_av_ct = rq->uq_arg_ct + 3;
+        spawn_av = unif_alloc(spawn_av, spawn_av_ct * sizeof(*spawn_av));
+    }
+    spawn_av[0] = exe;
+    memcpy(spawn_av + 1, rq->uq_args, rq->uq_arg_ct * sizeof(*spawn_av));
+    spawn_av[rq->uq_arg_ct + 1] = rq->uq_fname;
+    spawn_av[rq->uq_arg_ct + 2] = NULL;
+
+    if (pipe(pfd) != 0) {
+        fprintf(stderr, "pipe error %d (%s) for unifdef of %s\n",
+                errno, strerror(errno), rq->uq_fname);
+        return;
+    }
+    set_cloexec(pfd[0]);
+    set_cloexec(pfd[1]);
+#ifdef F_SETPIPE_SZ
+    /*
+     * A roomy pipe lets the child finish while we are busy scoring.
+     */
+    (void)fcntl(pfd[1], F_SETPIPE_SZ, UNIF_PIPE_SIZE);
+#endif
+
+    posix_spawn_file_actions_init(&fa);
+    posix_spawn_file_actions_adddup2(&fa, pfd[1], STDOUT_FILENO);
+    err = posix_spawnp(&us->us_pid, exe, &fa, NULL,
+                       (char * const *)spawn_av, environ);
+    posix_spawn_file_actions_destroy(&fa);
+    close(pfd[1]);
+
+    if (err != 0) {
+        fprintf(stderr, "could not run %s for %s: %s\n",
+                exe, rq->uq_fname, strerror(err));
+        close(pfd[0]);
+        return;
+    }
+
+    run_metrics.mt_spawned++;
+    (void)fcntl(pfd[0], F_SETFL, fcntl(pfd[0], F_GETFL) | O_NONBLOCK);
+    us->us_fd    = pfd[0];
+    us->us_state = US_RUNNING;
+    running_ct++;
+}
+
+/**
+ * Read whatever the child has written.  On end of file, reap the child.
+ */
+static void
+unif_drain(unif_slot_t * us)
+{
+    for (;;) {
+        if (us->us_size - us->us_len < 2) {
+            size_t sz = (us->us_size < UNIF_MIN_BUF)
+                ? UNIF_MIN_BUF : us->us_size * 2;
+            mem_account(MEM_TEXT, sz - us->us_size);
+            us->us_size = sz;
+            us->us_buf  = unif_alloc(us->us_buf, us->us_size);
+        }
+
+        ssize_t ct = read(us->us_fd, us->us_buf + us->us_len,
+                          us->us_size - us->us_len - 1);
+        if (ct > 0) {
+            us->us_len += ct;
+            continue;
+        }
+
+        if (ct < 0) {
+            if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+                return;
+            if (errno == EINTR)
+                continue;
+            fprintf(stderr, "read error %d (%s) on unifdef of %s\n",
+                    errno, strerror(errno), us->us_req.uq_fname);
+        }
+        break;
+    }
+
+    {
+        int status = 0;
+        close(us->us_fd);
+        while ((waitpid(us->us_pid, &status, 0) < 0) && (errno == EINTR))  ;
+
+        /*
+         * unifdef exits 0 for unchanged output, 1 for changed output
+         * and 2 for trouble.
+         */
+        us->us_ok    = WIFEXITED(status) && (WEXITSTATUS(status) <= 1);
+        us->us_state = US_DONE;
+        running_ct--;
+    }
+}
+
+/**
+ * Collect output from all running children until "want" is done.
+ */
+static void
+unif_pump(unif_slot_t * want)
+{
+    while (want->us_state == US_RUNNING) {
+        int ct = 0;
+
+        for (int ix = 0; ix < slot_ct; ix++) {
+            if (slots[ix].us_state != US_RUNNING)
+                continue;
+            poll_fds[ct] = (struct pollfd) {
+                .fd = slots[ix].us_fd, .events = POLLIN };
+            poll_ix[ct++] = ix;
+        }
+
+        if (poll(poll_fds, ct, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            die(COMPLEXITY_EXIT_BAD_FILE, "poll error %d (%s)\n",
+                errno, strerror(errno));
+        }
+
+        for (int ix = 0; ix < ct; ix++)
+            if (poll_fds[ix].revents != 0)
+                unif_drain(slots + poll_ix[ix]);
+    }
+}
+
+/**
+ * Start queued requests while there are free slots and job capacity.
+ */
+static void
+unif_fill(void)
+{
+    for (int ix = 0; (ix < slot_ct) && (q_head < q_tail); ix++) {
+        if (running_ct >= job_ct)
+            break;
+        if (slots[ix].us_state != US_IDLE)
+            continue;
+        slots[ix].us_req = queue[q_head++];
+        unif_spawn(slots + ix);
+    }
+}
+
+/**
+ * Make sure there is room for one more queue entry.
+ */
+static void
+queue_room(void)
+{
+    if (q_tail < q_alloc)
+        return;
+
+    if (q_head > 0) {
+        memmove(queue, queue + q_head, (q_tail - q_head) * sizeof(*queue));
+        q_tail -= q_head;
+        q_head  = 0;
+        return;
+    }
+
+    q_alloc = (q_alloc < 64) ? 64 : q_alloc * 2;
+    queue   = unif_alloc(queue, q_alloc * sizeof(*queue));
+}
+
+/**
+ * Queue a file for preprocessing ahead of the call to unif_text().
+ * The argument list must stay valid until then.
+ */
+void
+unif_queue(char const * fname, int ct, char const * const * args)
+{
+    if (! in_shard(fname) || ! in_sample(fname))
+        return; // will not be asked for
+
+    if (slots == NULL)
+        unif_init();
+
+    queue_room();
+    queue[q_tail++] = (unif_req_t) {
+        .uq_fname = fname, .uq_arg_ct = ct, .uq_args = args };
+    unif_fill();
+}
+
+/**
+ * Find a slot to run a request that was not prefetched.  If every slot is
+ * busy with prefetched work, the oldest one is put back on the queue.
+ */
+static unif_slot_t *
+unif_claim_slot(void)
+{
+    unif_slot_t * victim = NULL;
+
+    for (int ix = 0; ix < slot_ct; ix++) {
+        switch (slots[ix].us_state) {
+        case US_IDLE:
+            return slots + ix;
+
+        case US_IN_USE:
+            break;
+
+        default:
+            if (victim == NULL)
+                victim = slots + ix;
+        }
+    }
+
+    CX_ASSERT(victim != NULL);
+    unif_pump(victim);
+
+    if (q_head == 0) {
+        queue_room();
+        memmove(queue + 1, queue, q_tail * sizeof(*queue));
+        q_tail++;
+        q_head = 1;
+    }
+    queue[--q_head]  = victim->us_req;
+    victim->us_state = US_IDLE;
+    return victim;
+}
+
+/**
+ * Return the unifdef output for a file, NUL terminated.  The text
+ * belongs to the pool and must be handed back with unif_release().
+ * NULL is returned if unifdef could not be run or failed.
+ */
+char const *
+unif_text(char const * fname, int ct, char const * const * args)
+{
+    unif_slot_t * us = NULL;
+
+    if (slots == NULL)
+        unif_init();
+
+    for (int ix = 0; ix < slot_ct; ix++) {
+        if (  ((slots[ix].us_state == US_RUNNING)
+           ||  (slots[ix].us_state == US_DONE))
+           && same_req(&slots[ix].us_req, fname, ct, args)) {
+            us = slots + ix;
+            break;
+        }
+    }
+
+    if (us == NULL) {
+        /*
+         * Not started yet.  Pull it from the queue if it is there.
+         */
+        for (int ix = q_head; ix < q_tail; ix++) {
+            if (same_req(queue + ix, fname, ct, args)) {
+                memmove(queue + ix, queue + ix + 1,
+                        (q_tail - ix - 1) * sizeof(*queue));
+                q_tail--;
+                break;
+            }
+        }
+
+        us = unif_claim_slot();
+        us->us_req = (unif_req_t) {
+            .uq_fname = fname, .uq_arg_ct = ct, .uq_args = args };
+        unif_spawn(us);
+    }
+
+    unif_pump(us);
+    us->us_state = US_IN_USE;
+    unif_fill();
+
+    if (! us->us_ok)
+        return NULL;
+
+    if (us->us_buf == NULL) {
+        mem_account(MEM_TEXT, UNIF_MIN_BUF);
+        us->us_size = UNIF_MIN_BUF;
+        us->us_buf  = unif_alloc(NULL, us->us_size);
+    }
+    us->us_buf[us->us_len] = NUL;
+    return us->us_buf;
+}
+
+/**
+ * A queued file turned out not to be needed after all.
+ */
+void
+unif_discard(char const * fname, int ct, char const * const * args)
+{
+    if (slots == NULL)
+        return;
+
+    for (int ix = 0; ix < slot_ct; ix++) {
+        unif_slot_t * us = slots + ix;
+        if (  ((us->us_state == US_RUNNING) || (us->us_state == US_DONE))
+           && same_req(&us->us_req, fname, ct, args)) {
+            unif_pump(us);
+            us->us_state = US_IDLE;
+            unif_fill();
+            return;
+        }
+    }
+
+    for (int ix = q_head; ix < q_tail; ix++) {
+        if (same_req(queue + ix, fname, ct, args)) {
+            memmove(queue + ix, queue + ix + 1,
+                    (q_tail - ix - 1) * sizeof(*queue));
+            q_tail--;
+            return;
+        }
+    }
+}
+
+/**
+ * The scorer is finished with the text.  Reuse its slot.
+ */
+void
+unif_release(void)
+{
+    for (int ix = 0; ix < slot_ct; ix++) {
+        if (slots[ix].us_state == US_IN_USE)
+            slots[ix].us_state = US_IDLE;
+    }
+    unif_fill();
+}
+/*
+ * Local Variables:
+ * mode: C
+ * c-file-style: "stroustrup"
+ * indent-tabs-mode: nil
+ * End:
+ * end of unifdef.c */
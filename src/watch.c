@@ -0,0 +1,569 @@
+
+/*
+ *  This file is part of Complexity.
+ *  Complexity Copyright (c) 2011-2020 by Bruce Korb - all rights reserved
+ *
+ *  Complexity is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Complexity is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Watch a source tree.  Everything is scored once, then inotify events
+ * tell us which files to withdraw and score again.  The totals and the
+ * histogram are adjusted for just the changed files.
+ */
+
+#include "opts.h"
+#include <stdlib.h>
+
+#ifdef HAVE_SYS_INOTIFY_H
+#include <dirent.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#define WATCH_EVENTS \
+    (IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE | IN_CREATE)
+
+/*
+ * How long to wait for more events before reporting, in milliseconds.
+ * Editors and build tools tend to touch several files in a burst.
+ */
+#define WATCH_SETTLE_MS 200
+
+typedef struct {
+    char *          wf_name;
+    state_t **      wf_recs;    //!< this file's entries in "scores"
+    int             wf_ct;
+    int             wf_unscored;
+} watch_file_t;
+
+typedef struct {
+    char            wo_pname[256];
+    int             wo_score;
+    bool            wo_seen;
+} watch_old_t;
+
+static char const nomem_fmt[] = "could not allocate %d bytes\n";
+
+static watch_file_t * wfiles    = NULL;   //!< open addressed, by name
+static size_t         wf_mask   = 0;
+static size_t         wf_used   = 0;
+
+static char **        wdirs     = NULL;   //!< directory, by watch descr
+static int            wdir_ct   = 0;
+
+static char **        pending   = NULL;   //!< files changed in this batch
+static int            pend_ct   = 0;
+static int            pend_alloc = 0;
+
+static int            in_fd     = -1;
+static bool           rescanned = false;  //!< scores were all withdrawn
+static complexity_exit_code_t watch_res = COMPLEXITY_EXIT_SUCCESS;
+
+static void *
+watch_alloc(void * p, size_t sz)
+{
+    p = realloc(p, sz);
+    if (p == NULL)
+        die(COMPLEXITY_EXIT_NOMEM, nomem_fmt, (int)sz);
+    return p;
+}
+
+static char *
+watch_strdup(char const * str)
+{
+    size_t len = strlen(str) + 1;
+    return memcpy(watch_alloc(NULL, len), str, len);
+}
+
+static size_t
+wf_hash(char const * name)
+{
+    size_t h = 2166136261U;
+    while (*name != NUL)
+        h = (h ^ (unsigned char)*(name++)) * 16777619U;
+    return h;
+}
+
+/**
+ * Find the slot for a file name.  With "add", a new empty entry is
+ * made when the name is not yet known.
+ */
+static watch_file_t *
+wf_find(char const * name, bool add)
+{
+    if (wf_used * 2 >= wf_mask) {
+        watch_file_t * old = wfiles;
+        size_t old_ct = (wf_mask == 0) ? 0 : wf_mask + 1;
+        size_t new_ct = (old_ct == 0) ? 256 : old_ct * 2;
+
+        wfiles  = watch_alloc(NULL, new_ct * sizeof(*wfiles));
+        memset(wfiles, 0, new_ct * sizeof(*wfiles));
+        wf_mask = new_ct - 1;
+
+        for (size_t ix = 0; ix < old_ct; ix++) {
+            if (old[ix].wf_name != NULL) {
+                size_t h = wf_hash(old[ix].wf_name) & wf_mask;
+                while (wfiles[h].wf_name != NULL)
+                    h = (h + 1) & wf_mask;
+                wfiles[h] = old[ix];
+            }
+        }
+        free(old);
+    }
+
+    {
+        size_t h = wf_hash(name) & wf_mask;
+        while (wfiles[h].wf_name != NULL) {
+            if (strcmp(wfiles[h].wf_name, name) == 0)
+                return wfiles + h;
+            h = (h + 1) & wf_mask;
+        }
+
+        if (! add)
+            return NULL;
+
+        wf_used++;
+        wfiles[h].wf_name = watch_strdup(name);
+        return wfiles + h;
+    }
+}
+
+static bool
+is_source(char const * name)
+{
+    char const * dot = strrchr(name, '.');
+    return (dot != NULL) && ((strcmp(dot, ".c") == 0)
+                             || (strcmp(dot, ".h") == 0));
+}
+
+/**
+ * Withdraw the scores for a file and free the records.
+ */
+static void
+wf_forget(watch_file_t * wf)
+{
+    /*
+     * forget_scores() clears "st_end", where the shared file name is
+     * kept, so take the name first.
+     */
+    char * fname = (wf->wf_ct > 0) ? wf->wf_recs[0]->st_end : NULL;
+
+    forget_scores(wf->wf_recs, wf->wf_ct, wf->wf_unscored);
+
+    if (fname != NULL) {
+        mem_account(MEM_NAMES, -(long)(strlen(fname) + 1));
+        free(fname);
+    }
+    for (int ix = 0; ix < wf->wf_ct; ix++)
+        free(wf->wf_recs[ix]);
+    mem_account(MEM_STATE, -(long)(wf->wf_ct * sizeof(state_t)));
+
+    free(wf->wf_recs);
+    wf->wf_recs     = NULL;
+    wf->wf_ct       = 0;
+    wf->wf_unscored = 0;
+}
+
+/**
+ * Score a file, remembering which records belong to it.
+ */
+static void
+wf_score(watch_file_t * wf)
+{
+    int first    = score_ct;
+    int unscored = unscored_count();
+
+    watch_res |= complex_eval(wf->wf_name);
+
+    wf->wf_ct       = score_ct - first;
+    wf->wf_unscored = unscored_count() - unscored;
+    if (wf->wf_ct > 0) {
+        size_t sz   = wf->wf_ct * sizeof(state_t *);
+        wf->wf_recs = memcpy(watch_alloc(NULL, sz), scores_since(first), sz);
+    }
+}
+
+/**
+ * Queue a file for rescoring.  A file named by several events in
+ * one burst is only queued once.  Directory walks cannot repeat
+ * a name, so they skip that check.
+ */
+static void
+add_pending(char const * name, bool check)
+{
+    if (check)
+        for (int ix = 0; ix < pend_ct; ix++)
+            if (strcmp(pending[ix], name) == 0)
+                return;
+
+    if (pend_ct >= pend_alloc) {
+        pend_alloc += (pend_alloc == 0) ? 16 : pend_alloc;
+        pending = watch_alloc(pending, pend_alloc * sizeof(*pending));
+    }
+    pending[pend_ct++] = watch_strdup(name);
+}
+
+/**
+ * Add watches for a directory and everything beneath it.  The source
+ * files found are queued for scoring.
+ */
+static void
+watch_dir(char const * dname)
+{
+    DIR * dir;
+    struct dirent * de;
+    int wd = inotify_add_watch(in_fd, dname, WATCH_EVENTS | IN_ONLYDIR);
+
+    if (wd < 0) {
+        fprintf(stderr, "cannot watch %s: %s\n", dname, strerror(errno));
+        watch_res |= COMPLEXITY_EXIT_BAD_FILE;
+        return;
+    }
+
+    if (wd >= wdir_ct) {
+        int ct = wd + 64;
+        wdirs = watch_alloc(wdirs, ct * sizeof(*wdirs));
+        memset(wdirs + wdir_ct, 0, (ct - wdir_ct) * sizeof(*wdirs));
+        wdir_ct = ct;
+    }
+    free(wdirs[wd]);
+    wdirs[wd] = watch_strdup(dname);
+
+    dir = opendir(dname);
+    if (dir == NULL)
+        return;
+
+    while ((de = readdir(dir)) != NULL) {
+        struct stat sb;
+        size_t len;
+        char * path;
+
+        if (de->d_name[0] == '.')
+            continue;
+
+        len  = strlen(dname) + strlen(de->d_name) + 2;
+        path = watch_alloc(NULL, len);
+        snprintf(path, len, "%s/%s", dname, de->d_name);
+
+        if (stat(path, &sb) == 0) {
+            if (S_ISDIR(sb.st_mode))
+                watch_dir(path);
+            else if (S_ISREG(sb.st_mode) && is_source(path))
+                add_pending(path, false);
+        }
+        free(path);
+    }
+    closedir(dir);
+}
+
+/**
+ * Test whether "name" is "dname" or lies beneath it.
+ */
+static bool
+under_dir(char const * name, char const * dname, size_t dlen)
+{
+    return (strncmp(name, dname, dlen) == 0)
+        && ((name[dlen] == NUL) || (name[dlen] == '/'));
+}
+
+/**
+ * A directory was removed or moved away.  Queue every file known
+ * beneath it, so its scores are withdrawn, and drop the watches on it
+ * and its subdirectories.  A directory renamed within the tree comes
+ * back with IN_MOVED_TO and is walked again under its new name.
+ */
+static void
+drop_dir(char const * dname)
+{
+    size_t dlen = strlen(dname);
+
+    if (wfiles != NULL)
+        for (size_t ix = 0; ix <= wf_mask; ix++)
+            if (  (wfiles[ix].wf_name != NULL)
+               && under_dir(wfiles[ix].wf_name, dname, dlen))
+                add_pending(wfiles[ix].wf_name, true);
+
+    for (int wd = 0; wd < wdir_ct; wd++)
+        if ((wdirs[wd] != NULL) && under_dir(wdirs[wd], dname, dlen)) {
+            inotify_rm_watch(in_fd, wd);
+            free(wdirs[wd]);
+            wdirs[wd] = NULL;
+        }
+}
+
+/**
+ * The kernel dropped events, so nothing can be trusted.  Withdraw
+ * every score, forget the watches and walk the tree again.
+ */
+static void
+rescan_tree(void)
+{
+    if (wfiles != NULL)
+        for (size_t ix = 0; ix <= wf_mask; ix++)
+            if (wfiles[ix].wf_name != NULL)
+                wf_forget(wfiles + ix);
+
+    for (int ix = 0; ix < pend_ct; ix++)
+        free(pending[ix]);
+    pend_ct = 0;
+
+    for (int wd = 0; wd < wdir_ct; wd++)
+        if (wdirs[wd] != NULL) {
+            inotify_rm_watch(in_fd, wd);
+            free(wdirs[wd]);
+            wdirs[wd] = NULL;
+        }
+
+    fprintf(stderr, "inotify event queue overflowed, rescanning %s\n",
+            OPT_ARG(WATCH));
+    watch_dir(OPT_ARG(WATCH));
+    rescanned = true;
+}
+
+static int
+compare_old(void const * l, void const * r)
+{
+    return strcmp(((watch_old_t const *)l)->wo_pname,
+                  ((watch_old_t const *)r)->wo_pname);
+}
+
+/**
+ * Print how each procedure in a rescored file changed: its old and
+ * new score, or "-" where it was added or removed.
+ */
+static void
+print_deltas(watch_file_t const * wf, watch_old_t * old, int old_ct)
+{
+    qsort(old, old_ct, sizeof(*old), compare_old);
+
+    for (int ix = 0; ix < wf->wf_ct; ix++) {
+        state_t const * st = wf->wf_recs[ix];
+        int val = st->score + 0.5;
+        watch_old_t key;
+        watch_old_t * wo;
+
+        memcpy(key.wo_pname, st->pname, sizeof(key.wo_pname));
+        wo = bsearch(&key, old, old_ct, sizeof(*old), compare_old);
+        if (wo == NULL)
+            printf("%5s %5d %+6d  %s(%d) %s\n", "-", val, val,
+                   wf->wf_name, st->ln_st, st->pname);
+        else {
+            wo->wo_seen = true;
+            if (wo->wo_score != val)
+                printf("%5d %5d %+6d  %s(%d) %s\n", wo->wo_score, val,
+                       val - wo->wo_score, wf->wf_name, st->ln_st,
+                       st->pname);
+        }
+    }
+
+    for (int ix = 0; ix < old_ct; ix++)
+        if (! old[ix].wo_seen)
+            printf("%5d %5s %+6d  %s %s\n", old[ix].wo_score, "-",
+                   -old[ix].wo_score, wf->wf_name, old[ix].wo_pname);
+}
+
+/**
+ * Rescore every file changed in this batch.
+ */
+static void
+rescore_pending(bool deltas)
+{
+    for (int ix = 0; ix < pend_ct; ix++) {
+        struct stat sb;
+        bool exists = (stat(pending[ix], &sb) == 0) && S_ISREG(sb.st_mode);
+        watch_file_t * wf = wf_find(pending[ix], exists);
+        watch_old_t * old = NULL;
+        int old_ct = 0;
+
+        free(pending[ix]);
+        if (wf == NULL)
+            continue;
+
+        if (deltas && (wf->wf_ct > 0)) {
+            old_ct = wf->wf_ct;
+            old = watch_alloc(NULL, old_ct * sizeof(*old));
+            for (int ox = 0; ox < old_ct; ox++) {
+                memcpy(old[ox].wo_pname, wf->wf_recs[ox]->pname,
+                       sizeof(old[ox].wo_pname));
+                old[ox].wo_score = wf->wf_recs[ox]->score + 0.5;
+                old[ox].wo_seen  = false;
+            }
+        }
+
+        wf_forget(wf);
+        if (exists)
+            wf_score(wf);
+
+        if (deltas)
+            print_deltas(wf, old, old_ct);
+        free(old);
+    }
+    pend_ct = 0;
+}
+
+static void
+report(bool deltas)
+{
+    if (deltas) {
+        fflush(stdout);
+        return;
+    }
+
+    if (score_ct == 0)
+        printf("No procedures were scored\n");
+    else
+        do_summary(watch_res);
+    putc(NL, stdout);
+    fflush(stdout);
+}
+
+/**
+ * Read one burst of events, noting the files to rescore and any new
+ * directories to watch.
+ */
+static void
+read_events(void)
+{
+    char buf[16 * 1024]
+        __attribute__ ((aligned(__alignof__(struct inotify_event))));
+
+    for (;;) {
+        ssize_t len = read(in_fd, buf, sizeof(buf));
+        char const * scan = buf;
+
+        if (len <= 0) {
+            if ((len < 0) && (errno == EINTR))
+                continue;
+            return;
+        }
+
+        while (scan < buf + len) {
+            struct inotify_event const * ev = (void const *)scan;
+            char const * dname =
+                ((ev->wd >= 0) && (ev->wd < wdir_ct)) ? wdirs[ev->wd] : NULL;
+
+            scan += sizeof(*ev) + ev->len;
+
+            if (ev->mask & IN_Q_OVERFLOW) {
+                rescan_tree();
+                continue;
+            }
+
+            if (ev->mask & IN_IGNORED) {
+                if (dname != NULL) {
+                    free(wdirs[ev->wd]);
+                    wdirs[ev->wd] = NULL;
+                }
+                continue;
+            }
+
+            if ((dname == NULL) || (ev->len == 0)
+                || (ev->name[0] == '.'))
+                continue;
+
+            {
+                size_t plen = strlen(dname) + strlen(ev->name) + 2;
+                char * path = watch_alloc(NULL, plen);
+                snprintf(path, plen, "%s/%s", dname, ev->name);
+
+                if (ev->mask & IN_ISDIR) {
+                    if (ev->mask & (IN_MOVED_FROM | IN_DELETE))
+                        drop_dir(path);
+                    else if (ev->mask & (IN_CREATE | IN_MOVED_TO))
+                        watch_dir(path);
+
+                } else if (is_source(path)
+                           && (ev->mask & (IN_CLOSE_WRITE | IN_MOVED_TO
+                                           | IN_MOVED_FROM | IN_DELETE)))
+                    add_pending(path, true);
+
+                free(path);
+            }
+        }
+    }
+}
+
+/**
+ * Score the watched tree, then keep it scored.  This never returns.
+ */
+void
+watch_tree(void)
+{
+    char const * dname = OPT_ARG(WATCH);
+    struct pollfd pfd;
+
+    in_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (in_fd < 0)
+        die(COMPLEXITY_EXIT_BAD_FILE, "inotify_init1 failed: %s\n",
+            strerror(errno));
+
+    watch_dir(dname);
+    if (wdir_ct == 0)
+        exit(watch_res | COMPLEXITY_EXIT_BAD_FILE);
+
+    /*
+     * The initial scan always gets a full report.
+     */
+    rescore_pending(false);
+    report(false);
+
+    pfd = (struct pollfd) { .fd = in_fd, .events = POLLIN };
+
+    for (;;) {
+        if (poll(&pfd, 1, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            die(COMPLEXITY_EXIT_BAD_FILE, "poll failed: %s\n",
+                strerror(errno));
+        }
+
+        /*
+         * Let the burst settle before rescoring.
+         */
+        do  {
+            read_events();
+        } while (poll(&pfd, 1, WATCH_SETTLE_MS) > 0);
+
+        /*
+         * After a rescan there is nothing to compare against,
+         * so it gets a full report.
+         */
+        if ((pend_ct > 0) || rescanned) {
+            bool deltas = HAVE_OPT(WATCH_DELTAS) && ! rescanned;
+
+            rescanned = false;
+            rescore_pending(deltas);
+            report(deltas);
+        }
+    }
+}
+
+#else /* ! HAVE_SYS_INOTIFY_H */
+
+void
+watch_tree(void)
+{
+    die(COMPLEXITY_EXIT_BAD_FILE,
+        "--watch is not supported on this platform\n");
+}
+
+#endif /* HAVE_SYS_INOTIFY_H */
+/*
+ * Local Variables:
+ * mode: C
+ * c-file-style: "stroustrup"
+ * indent-tabs-mode: nil
+ * End:
+ * end of watch.c */